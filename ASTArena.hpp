@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ASTNode.hpp"
+
+/**
+ * Compact, index-linked copy of an AST.
+ * All nodes live in one contiguous vector and are laid out breadth-first, so the children of a
+ * node occupy a contiguous index range [first_child, first_child + num_children).  String values
+ * (print literals and operator names) live in a deduplicated side table.
+ * The arena is a lowering format for the bytecode compiler and JIT, not the parser's storage:
+ * it is flattened from the finished ASTNode tree after the tree passes have run.  Parsing still
+ * allocates per node, and the tree and the arena both exist while flattening.
+ */
+class ASTArena
+{
+public:
+  struct Node {
+    double value;           // For number literals
+    uint32_t first_child;   // Index of the first child in the arena
+    uint32_t num_children;
+    uint32_t aux;           // Slot for VARIABLE nodes, otherwise an index into the string table
+    uint16_t op;            // Operator token ID (see ASTNode::GetOp)
+    uint8_t type;           // ASTNode::Type
+  };
+  static_assert(sizeof(Node) == 24, "ASTArena::Node should stay at 24 bytes.");
+
+  static constexpr uint32_t NO_STR = static_cast<uint32_t>(-1);
+
+private:
+  std::vector<Node> nodes{};
+  std::vector<std::string> strings{};
+
+public:
+  ASTArena() = default;
+
+  // Flatten a tree into the arena; node storage is allocated exactly once.
+  explicit ASTArena(const ASTNode & root) {
+    nodes.reserve(CountNodes(root));
+
+    std::unordered_map<std::string, uint32_t> string_ids;
+    std::vector<const ASTNode *> queue;   // Source node for each arena index, in BFS order.
+    queue.reserve(nodes.capacity());
+    queue.push_back(&root);
+
+    for (size_t i = 0; i < queue.size(); ++i) {
+      const ASTNode & src = *queue[i];
+      Node node{};
+      node.type = static_cast<uint8_t>(src.GetType());
+      node.value = src.GetValue();
+      node.op = static_cast<uint16_t>(src.GetOp());
+      if (src.GetType() == ASTNode::VARIABLE) {
+        node.aux = static_cast<uint32_t>(src.GetVarID());
+      } else if (src.GetStrValue().size()) {
+        auto [it, added] = string_ids.try_emplace(src.GetStrValue(), static_cast<uint32_t>(strings.size()));
+        if (added) strings.push_back(src.GetStrValue());
+        node.aux = it->second;
+      } else {
+        node.aux = NO_STR;
+      }
+      node.first_child = static_cast<uint32_t>(queue.size());
+      node.num_children = static_cast<uint32_t>(src.GetChildren().size());
+      for (const auto & child : src.GetChildren()) queue.push_back(&child);
+      nodes.push_back(node);
+    }
+  }
+
+  // Count nodes in a tree without recursion.
+  static size_t CountNodes(const ASTNode & root) {
+    size_t count = 0;
+    std::vector<const ASTNode *> stack{&root};
+    while (stack.size()) {
+      const ASTNode * node = stack.back();
+      stack.pop_back();
+      ++count;
+      for (const auto & child : node->GetChildren()) stack.push_back(&child);
+    }
+    return count;
+  }
+
+  // Heap and inline bytes held by a pointer-based tree.
+  static size_t TreeBytes(const ASTNode & root) {
+    size_t bytes = sizeof(ASTNode);
+    std::vector<const ASTNode *> stack{&root};
+    while (stack.size()) {
+      const ASTNode * node = stack.back();
+      stack.pop_back();
+      bytes += node->GetChildren().capacity() * sizeof(ASTNode);
+      // Strings past the small-string buffer live on the heap.
+      if (node->GetStrValue().capacity() > std::string().capacity()) {
+        bytes += node->GetStrValue().capacity() + 1;
+      }
+      for (const auto & child : node->GetChildren()) stack.push_back(&child);
+    }
+    return bytes;
+  }
+
+  size_t size() const { return nodes.size(); }
+  size_t Bytes() const {
+    size_t bytes = sizeof(*this) + nodes.capacity() * sizeof(Node)
+      + strings.capacity() * sizeof(std::string);
+    for (const auto & str : strings) {
+      if (str.capacity() > std::string().capacity()) bytes += str.capacity() + 1;
+    }
+    return bytes;
+  }
+
+  static constexpr uint32_t ROOT = 0;
+
+  const Node & operator[](uint32_t id) const { return nodes[id]; }
+  ASTNode::Type GetType(uint32_t id) const { return static_cast<ASTNode::Type>(nodes[id].type); }
+  double GetValue(uint32_t id) const { return nodes[id].value; }
+  int GetOp(uint32_t id) const { return nodes[id].op; }
+  size_t GetVarID(uint32_t id) const { return nodes[id].aux; }
+  uint32_t NumChildren(uint32_t id) const { return nodes[id].num_children; }
+  uint32_t GetChild(uint32_t id, uint32_t child) const {
+    assert(child < nodes[id].num_children);
+    return nodes[id].first_child + child;
+  }
+
+  const std::string & GetStrValue(uint32_t id) const {
+    static const std::string empty;
+    const Node & node = nodes[id];
+    if (node.type == ASTNode::VARIABLE || node.aux == NO_STR) return empty;
+    return strings[node.aux];
+  }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -18,7 +19,7 @@ class ASTNode
 {
 public:
   // All types of nodes we have in our tree
-  enum Type {
+  enum Type : uint8_t {
     EMPTY = 0,
     SCOPE,
     VARIABLE,
@@ -38,12 +39,38 @@ public:
   };
 
 private:
+  // type, op and line_num share one word so the line costs no extra space per node.
   Type type{EMPTY};
-  size_t var_id{}; //If node is a variable, this represents it's index in var_info vector
+  int16_t op{0}; // For operator and MODIFIER nodes, the lexer's token ID for the operator
+  uint32_t line_num{0}; // Source line the node came from (0 if unknown), for the profiler
+  size_t var_id{}; //If node is a variable, this is its slot in the runtime frame
   double value{}; //For number literals
   std::string str_value;  // For string literals
   std::vector<ASTNode> children{};
 
+  static constexpr size_t MAX_FREE_DEPTH = 1000;   // Deepest recursion in the destructor
+
+  [[gnu::noinline]] void FreeChildren() {
+    static thread_local size_t depth = 0;
+    if (depth < MAX_FREE_DEPTH) {
+      ++depth;
+      children.clear();
+      --depth;
+      return;
+    }
+    std::vector<ASTNode> pending;
+    for (ASTNode & child : children) {
+      if (child.children.size()) pending.push_back(std::move(child));
+    }
+    while (pending.size()) {
+      ASTNode node = std::move(pending.back());
+      pending.pop_back();
+      for (ASTNode & child : node.children) {
+        if (child.children.size()) pending.push_back(std::move(child));
+      }
+    }   // Every node freed in the loop has only leaves and moved-from husks left
+  }
+
 // Public member functions
 public:
   // Constructors
@@ -59,30 +86,34 @@ public:
   ASTNode(Type type, const std::string &str_value) 
     : type(type), value(0.0), str_value(str_value) {}
 
-  // Constructor with one child
-  ASTNode(Type type, ASTNode child) : type(type), value(0.0), str_value("") 
+  // Constructor with one child (children are moved in, never copied)
+  ASTNode(Type type, ASTNode && child) : type(type), value(0.0), str_value("") 
   {
-    AddChild(child);
+    AddChild(std::move(child));
   }
 
   // Constructor with two children
-  ASTNode(Type type, ASTNode child1, ASTNode child2) 
+  ASTNode(Type type, ASTNode && child1, ASTNode && child2) 
       : type(type), value(0.0), str_value("") 
   {
-      AddChild(child1);
-      AddChild(child2);
+      children.reserve(2);
+      AddChild(std::move(child1));
+      AddChild(std::move(child2));
   }
 
-  // Copy constructor
-  ASTNode(const ASTNode &) = default;
+  // Nodes are move-only so a subtree can never be deep-copied by accident.
+  ASTNode(const ASTNode &) = delete;
   // Move constructor
   ASTNode(ASTNode &&) = default;
   // Copy operator
-  ASTNode & operator=(const ASTNode &) = default;
+  ASTNode & operator=(const ASTNode &) = delete;
   // Move operator
   ASTNode & operator=(ASTNode &&) = default;
-  // Destructor
-  ~ASTNode() = default;
+  // Destructor.  Ordinary trees are freed by plain recursion; past MAX_FREE_DEPTH levels the
+  // rest is torn down from a heap stack instead, so a tree of any depth can be freed.
+  ~ASTNode() {
+    if (children.size()) FreeChildren();
+  }
 
   // Type getter
   Type GetType() const { return type; }
@@ -92,14 +123,18 @@ public:
   const std::string &GetStrValue() const { return str_value; }
   //Gets the var_id
   size_t GetVarID() const { return var_id; }
+  // Operator token ID (see emplex::Lexer::ID_PLUS and friends)
+  int GetOp() const { return op; }
+  size_t GetLine() const { return line_num; }
 
   // Children management (daycare)
   const std::vector<ASTNode> & GetChildren() const {return children;}
+  std::vector<ASTNode> & GetChildren() {return children;}
 
   // Add child
-  void AddChild(ASTNode child) {
+  void AddChild(ASTNode && child) {
     assert(child.GetType() != EMPTY);
-    children.push_back(child);
+    children.push_back(std::move(child));
   }
 
   // Get specific child
@@ -107,10 +142,22 @@ public:
     assert(id < children.size());
     return children[id];
   }
+  ASTNode &GetChild(size_t id) {
+    assert(id < children.size());
+    return children[id];
+  }
+
+  // Replace this node with one of its own children (e.g. to drop a pass-through wrapper)
+  void ReplaceWithChild(size_t id) {
+    ASTNode child = std::move(GetChild(id));
+    *this = std::move(child);
+  }
 
   // value setters
   void SetValue(double in) { value = in; }
   void SetStrValue(const std::string &in) { str_value = in; }
   void SetVarID(size_t var_id) { this->var_id = var_id; }
+  void SetOp(int in) { op = static_cast<int16_t>(in); }
+  void SetLine(size_t in) { line_num = static_cast<uint32_t>(in); }
 
 };
@@ -0,0 +1,749 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ASTArena.hpp"
+#include "MacroCalcError.hpp"
+#include "NativeJit.hpp"
+#include "OutputSink.hpp"
+
+/**
+ * Flat bytecode for the register VM.
+ * Every instruction names its operands by register index.  The register file is laid out as
+ *   [ variable slots | constants | temporaries ]
+ * so variables and literals need no load instructions and the VM never looks at a name.
+ */
+class Bytecode
+{
+public:
+  enum Op : uint8_t {
+    HALT = 0,
+    MOVE,           // r[a] = r[b]
+    ADD,            // r[a] = r[b] + r[c]
+    SUB,
+    MUL,
+    DIV,            // Errors on division by zero
+    MOD,            // Errors on modulus by zero
+    POW,
+    DIV_NONZERO,    // As DIV and MOD, for a divisor that is a nonzero constant
+    MOD_NONZERO,
+    MOD_INT,        // As MOD, for a whole divisor: int64 remainder when both operands fit
+    MOD_INT_NONZERO,
+    POW_INT,        // As POW, for whole operands: repeated multiplication when exact
+    LESS,           // r[a] = r[b] < r[c] ? 1 : 0
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+    EQUAL,
+    NOT_EQUAL,
+    NEGATE,         // r[a] = r[b] * -1
+    NOT,            // r[a] = r[b] == 0 ? 1 : 0
+    TO_BOOL,        // r[a] = r[b] != 0 ? 1 : 0
+    JUMP,           // pc = a
+    JUMP_IF_FALSE,  // if (r[a] == 0) pc = b
+    JUMP_IF_TRUE,   // if (r[a] != 0) pc = b
+    JUMP_UNLESS_LESS,         // if (!(r[a] < r[b])) pc = c, and so on for each comparison
+    JUMP_UNLESS_LESS_EQUAL,
+    JUMP_UNLESS_GREATER,
+    JUMP_UNLESS_GREATER_EQUAL,
+    JUMP_UNLESS_EQUAL,
+    JUMP_UNLESS_NOT_EQUAL,
+    JUMP_UNLESS_DIVISIBLE,    // if (r[a] % r[b] != 0) pc = c, for a whole nonzero constant r[b]
+    PRINT_STRING,   // Print strings[a]
+    PRINT_NUMBER,   // Print r[a]
+    PRINT_NEWLINE,
+    NATIVE_LOOP     // Run native code at offset a, then pc = b; falls through if there is none
+  };
+
+  // Statement shapes the compiler fuses into fewer instructions, recorded per instruction so
+  // the VM can count how often each one runs.
+  enum Fusion : uint8_t {
+    NOT_FUSED = 0,
+    UPDATE_CONST,   // x = x op c: the operator writes x directly, with no MOVE
+    UPDATE,         // x = x op y
+    ASSIGN_OP,      // x = y op z
+    COMPARE_JUMP,   // if / while (y cmp z): compare and branch in one instruction
+    DIVISIBLE_JUMP, // if / while (y % c == 0)
+    NUM_FUSIONS
+  };
+
+  struct Instruction {
+    Op op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+  };
+
+  std::vector<Instruction> code{};
+  std::vector<double> constants{};     // Loaded into registers right after the variable slots
+  std::vector<std::string> strings{};  // String table for PRINT_STRING
+  size_t num_slots{0};                 // Number of variable registers
+  size_t num_registers{0};             // Total register file size
+  std::shared_ptr<const NativeCode> native{};   // JIT-compiled loops, if any
+  std::vector<Fusion> fusions{};       // Per instruction, if known (not kept by BytecodeCache)
+
+  static const char * OpName(Op op) {
+    switch (op) {
+    case HALT: return "HALT";
+    case MOVE: return "MOVE";
+    case ADD: return "ADD";
+    case SUB: return "SUB";
+    case MUL: return "MUL";
+    case DIV: return "DIV";
+    case MOD: return "MOD";
+    case POW: return "POW";
+    case DIV_NONZERO: return "DIV_NONZERO";
+    case MOD_NONZERO: return "MOD_NONZERO";
+    case MOD_INT: return "MOD_INT";
+    case MOD_INT_NONZERO: return "MOD_INT_NONZERO";
+    case POW_INT: return "POW_INT";
+    case LESS: return "LESS";
+    case LESS_EQUAL: return "LESS_EQUAL";
+    case GREATER: return "GREATER";
+    case GREATER_EQUAL: return "GREATER_EQUAL";
+    case EQUAL: return "EQUAL";
+    case NOT_EQUAL: return "NOT_EQUAL";
+    case NEGATE: return "NEGATE";
+    case NOT: return "NOT";
+    case TO_BOOL: return "TO_BOOL";
+    case JUMP: return "JUMP";
+    case JUMP_IF_FALSE: return "JUMP_IF_FALSE";
+    case JUMP_IF_TRUE: return "JUMP_IF_TRUE";
+    case JUMP_UNLESS_LESS: return "JUMP_UNLESS_LESS";
+    case JUMP_UNLESS_LESS_EQUAL: return "JUMP_UNLESS_LESS_EQUAL";
+    case JUMP_UNLESS_GREATER: return "JUMP_UNLESS_GREATER";
+    case JUMP_UNLESS_GREATER_EQUAL: return "JUMP_UNLESS_GREATER_EQUAL";
+    case JUMP_UNLESS_EQUAL: return "JUMP_UNLESS_EQUAL";
+    case JUMP_UNLESS_NOT_EQUAL: return "JUMP_UNLESS_NOT_EQUAL";
+    case JUMP_UNLESS_DIVISIBLE: return "JUMP_UNLESS_DIVISIBLE";
+    case PRINT_STRING: return "PRINT_STRING";
+    case PRINT_NUMBER: return "PRINT_NUMBER";
+    case PRINT_NEWLINE: return "PRINT_NEWLINE";
+    case NATIVE_LOOP: return "NATIVE_LOOP";
+    }
+    return "UNKNOWN";
+  }
+
+  static const char * FusionName(Fusion fusion) {
+    switch (fusion) {
+    case NOT_FUSED: return "not_fused";
+    case UPDATE_CONST: return "update_const";
+    case UPDATE: return "update";
+    case ASSIGN_OP: return "assign_op";
+    case COMPARE_JUMP: return "compare_jump";
+    case DIVISIBLE_JUMP: return "divisible_jump";
+    case NUM_FUSIONS: break;
+    }
+    return "unknown";
+  }
+
+  // Human-readable listing, useful when debugging the compiler.
+  void Print(std::ostream & os) const {
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+      const Instruction & inst = code[pc];
+      os << pc << ": " << OpName(inst.op) << " " << inst.a << " " << inst.b << " " << inst.c << "\n";
+    }
+  }
+};
+
+
+/**
+ * Lowers a flattened AST into Bytecode.
+ * Operators are resolved to opcodes once here, so the VM never compares operator strings.
+ */
+class BytecodeCompiler
+{
+private:
+  using node_t = uint32_t;
+
+  Bytecode & out;
+  const ASTArena & ast;
+  std::vector<bool> side_effects{};   // Per node: does evaluating it write to a variable?
+  std::vector<bool> integral{};       // Per node: is its value never a finite fraction?
+  size_t next_temp{0};   // Next free temporary register (relative to the start of temporaries)
+  size_t max_temp{0};
+  std::unordered_map<uint64_t, uint32_t> const_ids{};  // Constant bits -> register
+  JitCompiler * jit{nullptr};         // Compiles numeric loops to machine code, if enabled
+
+  uint32_t TempBase() const {
+    return static_cast<uint32_t>(out.num_slots + out.constants.size());
+  }
+
+  bool IsVarReg(uint32_t reg) const { return reg < out.num_slots; }
+
+  // Temporaries are renumbered after compilation once the constant count is known.
+  static constexpr uint32_t TEMP_FLAG = 0x80000000u;
+
+  uint32_t NewTemp() {
+    uint32_t reg = static_cast<uint32_t>(next_temp++) | TEMP_FLAG;
+    if (next_temp > max_temp) max_temp = next_temp;
+    return reg;
+  }
+
+  uint32_t AddConstant(double value) {
+    // Key on the bit pattern so -0.0 and 0.0 stay distinct.
+    const uint64_t bits = std::bit_cast<uint64_t>(value);
+    auto it = const_ids.find(bits);
+    if (it != const_ids.end()) return it->second;
+    const uint32_t reg = static_cast<uint32_t>(out.num_slots + out.constants.size());
+    out.constants.push_back(value);
+    const_ids[bits] = reg;
+    return reg;
+  }
+
+  uint32_t AddString(const std::string & str) {
+    out.strings.push_back(str);
+    return static_cast<uint32_t>(out.strings.size() - 1);
+  }
+
+  size_t Emit(Bytecode::Op op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+    out.code.push_back({op, a, b, c});
+    out.fusions.push_back(Bytecode::NOT_FUSED);
+    return out.code.size() - 1;
+  }
+
+  bool IsConstReg(uint32_t reg) const { return reg >= out.num_slots && reg < TempBase(); }
+
+  // Did the last instruction compute temporary `reg` with a plain three-register operator?
+  // Only LOGICAL_OP branches inside an expression, and it ends in TO_BOOL, so nothing can jump
+  // between such an instruction and whatever is emitted next.
+  bool LastComputed(uint32_t reg) const {
+    if (!(reg & TEMP_FLAG) || out.code.empty() || out.code.back().a != reg) return false;
+    const Bytecode::Op op = out.code.back().op;
+    return op >= Bytecode::ADD && op <= Bytecode::NOT_EQUAL;
+  }
+
+  // x = y op z: have the operator write x itself instead of a temporary and a MOVE.
+  bool FuseAssign(uint32_t var, uint32_t rhs) {
+    if (!LastComputed(rhs)) return false;
+    Bytecode::Instruction & last = out.code.back();
+    last.a = var;
+    if (last.b == var || last.c == var) {
+      const bool constant = IsConstReg(last.b) || IsConstReg(last.c);
+      out.fusions.back() = constant ? Bytecode::UPDATE_CONST : Bytecode::UPDATE;
+    } else {
+      out.fusions.back() = Bytecode::ASSIGN_OP;
+    }
+    return true;
+  }
+
+  static Bytecode::Op JumpUnless(Bytecode::Op compare) {
+    return static_cast<Bytecode::Op>(Bytecode::JUMP_UNLESS_LESS + (compare - Bytecode::LESS));
+  }
+
+  // Emit a branch taken when `node` is false, with its target left to PatchJump.  A comparison
+  // (or a divisibility test) computed just before is folded into the branch.
+  size_t CompileJumpIfFalse(node_t node) {
+    const uint32_t cond = CompileExpr(node);
+    if (LastComputed(cond) && out.code.back().op >= Bytecode::LESS) {
+      Bytecode::Instruction compare = out.code.back();
+      out.code.pop_back();
+      out.fusions.pop_back();
+      const size_t n = out.code.size();
+      if (compare.op == Bytecode::EQUAL && IsConstReg(compare.c)
+          && out.constants[compare.c - out.num_slots] == 0.0 && n > 0
+          && out.code[n - 1].op == Bytecode::MOD_INT_NONZERO && LastComputed(compare.b)) {
+        const Bytecode::Instruction mod = out.code.back();
+        out.code.pop_back();
+        out.fusions.pop_back();
+        const size_t at = Emit(Bytecode::JUMP_UNLESS_DIVISIBLE, mod.b, mod.c);
+        out.fusions[at] = Bytecode::DIVISIBLE_JUMP;
+        return at;
+      }
+      const size_t at = Emit(JumpUnless(compare.op), compare.b, compare.c);
+      out.fusions[at] = Bytecode::COMPARE_JUMP;
+      return at;
+    }
+    return Emit(Bytecode::JUMP_IF_FALSE, cond);
+  }
+
+  void PatchJump(size_t at, uint32_t target) {
+    if (out.code[at].op == Bytecode::JUMP_IF_FALSE) out.code[at].b = target;
+    else out.code[at].c = target;
+  }
+
+  uint32_t Here() const { return static_cast<uint32_t>(out.code.size()); }
+
+  // Children always follow their parent in the arena, so one reverse sweep sees children first.
+  void FindSideEffects() {
+    side_effects.assign(ast.size(), false);
+    for (size_t id = ast.size(); id-- > 0; ) {
+      bool found = (ast.GetType(id) == ASTNode::ASSIGN);
+      for (node_t i = 0; i < ast.NumChildren(id) && !found; ++i) {
+        found = side_effects[ast.GetChild(id, i)];
+      }
+      side_effects[id] = found;
+    }
+  }
+
+  // Could `node` ever produce a finite value with a fractional part?  Infinities, NaN and
+  // values beyond int64 still count as integral; the VM checks magnitudes as it goes.
+  bool IntegralNode(node_t node, const std::vector<bool> & slot_integral) const {
+    using L = emplex::Lexer;
+    auto child = [&](node_t i) -> bool { return integral[ast.GetChild(node, i)]; };
+    switch (ast.GetType(node)) {
+    case ASTNode::NUMBER: {
+      const double value = ast.GetValue(node);
+      return !std::isfinite(value) || value == std::trunc(value);
+    }
+    case ASTNode::VARIABLE:
+      return slot_integral[ast.GetVarID(node)];
+    case ASTNode::PARENTH:
+      return child(0);
+    case ASTNode::ASSIGN:
+      return child(1);
+    case ASTNode::MATH_OP:
+      switch (ast.GetOp(node)) {
+      case L::ID_PLUS:
+      case L::ID_MINUS:
+      case L::ID_TIMES:
+      case L::ID_MODULUS:
+        return child(0) && child(1);
+      case L::ID_POWER:
+        return child(0) && WholeExponent(ast.GetChild(node, 1));
+      default:
+        return false;
+      }
+    case ASTNode::MODIFIER:
+      return ast.GetOp(node) != L::ID_MINUS || child(0);
+    default:
+      return true;   // Comparisons and logic give 0 or 1; anything else evaluates to 0
+    }
+  }
+
+  // Numeric type inference: which nodes and variable slots only ever hold whole numbers.
+  // Variables start at 0 and change only by assignment, so a slot is integral if every value
+  // assigned to it is.  Start by assuming all slots are and retract until nothing changes.
+  void FindIntegral(size_t num_slots) {
+    std::vector<bool> slot_integral(num_slots, true);
+    integral.assign(ast.size(), false);
+    for (size_t pass = 0; ; ++pass) {
+      // Convergence takes one pass per link in a chain of copies; give up on long chains.
+      if (pass == 16) slot_integral.assign(num_slots, false);
+      bool changed = false;
+      for (size_t id = ast.size(); id-- > 0; ) {
+        integral[id] = IntegralNode(static_cast<node_t>(id), slot_integral);
+        if (ast.GetType(id) != ASTNode::ASSIGN || integral[id]) continue;
+        const size_t slot = ast.GetVarID(ast.GetChild(id, 0));
+        if (slot_integral[slot]) {
+          slot_integral[slot] = false;
+          changed = true;
+        }
+      }
+      if (!changed || pass == 16) return;
+    }
+  }
+
+  // Is `node` a literal, non-negative whole number?  Whole numbers raised to it stay whole.
+  bool WholeExponent(node_t node) const {
+    while (ast.GetType(node) == ASTNode::PARENTH) node = ast.GetChild(node, 0);
+    if (ast.GetType(node) != ASTNode::NUMBER) return false;
+    const double value = ast.GetValue(node);
+    return value >= 0 && value == std::trunc(value);
+  }
+
+  // Is `node` a literal other than zero?  Such divisors need no check.
+  bool NonzeroConstant(node_t node) const {
+    while (ast.GetType(node) == ASTNode::PARENTH) node = ast.GetChild(node, 0);
+    return ast.GetType(node) == ASTNode::NUMBER && ast.GetValue(node) != 0.0;
+  }
+
+  // Pick the cheapest opcode for a math operator that inference allows.
+  Bytecode::Op MathOp(node_t node) const {
+    const Bytecode::Op op = BinaryOp(ast.GetOp(node));
+    const node_t lhs = ast.GetChild(node, 0);
+    const node_t rhs = ast.GetChild(node, 1);
+    switch (op) {
+    case Bytecode::DIV:
+      return NonzeroConstant(rhs) ? Bytecode::DIV_NONZERO : op;
+    case Bytecode::MOD:
+      if (integral[rhs]) return NonzeroConstant(rhs) ? Bytecode::MOD_INT_NONZERO : Bytecode::MOD_INT;
+      return NonzeroConstant(rhs) ? Bytecode::MOD_NONZERO : op;
+    case Bytecode::POW:
+      return integral[lhs] && integral[rhs] ? Bytecode::POW_INT : op;
+    default:
+      return op;
+    }
+  }
+
+  // Map an operator token ID to its opcode.
+  static Bytecode::Op BinaryOp(int op) {
+    using L = emplex::Lexer;
+    switch (op) {
+    case L::ID_PLUS: return Bytecode::ADD;
+    case L::ID_MINUS: return Bytecode::SUB;
+    case L::ID_TIMES: return Bytecode::MUL;
+    case L::ID_DIVIDE: return Bytecode::DIV;
+    case L::ID_MODULUS: return Bytecode::MOD;
+    case L::ID_POWER: return Bytecode::POW;
+    case L::ID_LESS: return Bytecode::LESS;
+    case L::ID_LESS_EQUAL: return Bytecode::LESS_EQUAL;
+    case L::ID_GREATER: return Bytecode::GREATER;
+    case L::ID_GREATER_EQUAL: return Bytecode::GREATER_EQUAL;
+    case L::ID_EQUAL: return Bytecode::EQUAL;
+    case L::ID_NOT_EQUAL: return Bytecode::NOT_EQUAL;
+    }
+    Error(0, "Unknown operator '", emplex::Lexer::TokenName(op), "'.");
+    return Bytecode::HALT;
+  }
+
+  // Compile an expression and return the register holding its value.  Subexpressions are
+  // visited from an explicit stack, so nesting depth is limited only by memory; each frame
+  // records how far its node has got, and finished subexpressions leave their register on
+  // `values`.  Binary operators evaluate the lhs first, matching MacroCalc::Run.
+  uint32_t CompileExpr(node_t root) {
+    struct Frame {
+      node_t node;
+      int stage;
+      uint32_t dest;   // LOGICAL_OP: the register holding the result
+      size_t skip;     // LOGICAL_OP: the jump past the rhs
+    };
+    std::vector<Frame> frames{{root, 0, 0, 0}};
+    std::vector<uint32_t> values;
+    while (frames.size()) {
+      Frame & frame = frames.back();
+      const node_t node = frame.node;
+      const ASTNode::Type type = ast.GetType(node);
+      const int stage = frame.stage++;
+      switch (type) {
+      case ASTNode::NUMBER:
+        values.push_back(AddConstant(ast.GetValue(node)));
+        break;
+      case ASTNode::VARIABLE:
+        values.push_back(static_cast<uint32_t>(ast.GetVarID(node)));
+        break;
+      case ASTNode::PARENTH:
+        frame = {ast.GetChild(node, 0), 0, 0, 0};
+        continue;
+      case ASTNode::ASSIGN: {
+        if (stage == 0) {
+          frames.push_back({ast.GetChild(node, 1), 0, 0, 0});
+          continue;
+        }
+        const uint32_t rhs = values.back();
+        const uint32_t var = static_cast<uint32_t>(ast.GetVarID(ast.GetChild(node, 0)));
+        if (rhs != var && !FuseAssign(var, rhs)) Emit(Bytecode::MOVE, var, rhs);
+        values.back() = var;
+        break;
+      }
+      case ASTNode::MATH_OP:
+      case ASTNode::COMP_OP: {
+        if (stage == 0) {
+          frames.push_back({ast.GetChild(node, 0), 0, 0, 0});
+          continue;
+        }
+        if (stage == 1) {
+          // If the rhs may overwrite a variable the lhs just read, snapshot the lhs first.
+          uint32_t & lhs = values.back();
+          if (IsVarReg(lhs) && side_effects[ast.GetChild(node, 1)]) {
+            const uint32_t copy = NewTemp();
+            Emit(Bytecode::MOVE, copy, lhs);
+            lhs = copy;
+          }
+          frames.push_back({ast.GetChild(node, 1), 0, 0, 0});
+          continue;
+        }
+        const uint32_t rhs = values.back();
+        values.pop_back();
+        const uint32_t dest = NewTemp();
+        Emit(type == ASTNode::MATH_OP ? MathOp(node) : BinaryOp(ast.GetOp(node)), dest, values.back(), rhs);
+        values.back() = dest;
+        break;
+      }
+      case ASTNode::LOGICAL_OP: {
+        // dest = bool(lhs); skip the rhs if that already decides the result.
+        if (stage == 0) {
+          frame.dest = NewTemp();
+          frames.push_back({ast.GetChild(node, 0), 0, 0, 0});
+          continue;
+        }
+        Emit(Bytecode::TO_BOOL, frame.dest, values.back());
+        if (stage == 1) {
+          const bool is_and = (ast.GetOp(node) == emplex::Lexer::ID_AND);
+          values.pop_back();
+          frame.skip = Emit(is_and ? Bytecode::JUMP_IF_FALSE : Bytecode::JUMP_IF_TRUE, frame.dest);
+          frames.push_back({ast.GetChild(node, 1), 0, 0, 0});
+          continue;
+        }
+        out.code[frame.skip].b = Here();
+        values.back() = frame.dest;
+        break;
+      }
+      case ASTNode::MODIFIER: {
+        if (stage == 0) {
+          frames.push_back({ast.GetChild(node, 0), 0, 0, 0});
+          continue;
+        }
+        const uint32_t dest = NewTemp();
+        Emit(ast.GetOp(node) == emplex::Lexer::ID_MINUS ? Bytecode::NEGATE : Bytecode::NOT, dest, values.back());
+        values.back() = dest;
+        break;
+      }
+      default:
+        // Anything else evaluates to zero, as in MacroCalc::Run.
+        values.push_back(AddConstant(0.0));
+        break;
+      }
+      frames.pop_back();   // This node's value is on `values`
+    }
+    return values.back();
+  }
+
+  // Compile a statement and everything nested in it, again from an explicit stack.
+  void CompileStatement(node_t root) {
+    struct Frame {
+      node_t node;
+      size_t stage;       // SCOPE: the next child to compile
+      size_t jump{0};     // IF: the branch to the else part, then the jump past it; WHILE: the exit
+      uint32_t top{0};    // WHILE: the start of the condition
+      size_t native_pc{0};
+      bool native{false};
+    };
+    std::vector<Frame> frames{{root, 0}};
+    while (frames.size()) {
+      Frame & frame = frames.back();
+      const node_t node = frame.node;
+      const size_t stage = frame.stage++;
+      if (stage == 0) next_temp = 0;  // Temporaries never live across statements.
+      switch (ast.GetType(node)) {
+      case ASTNode::EMPTY:
+        break;
+      case ASTNode::SCOPE:
+        if (stage < ast.NumChildren(node)) {
+          frames.push_back({ast.GetChild(node, static_cast<node_t>(stage)), 0});
+          continue;
+        }
+        break;
+      case ASTNode::PRINT:
+        for (node_t i = 0; i < ast.NumChildren(node); ++i) {
+          const node_t child = ast.GetChild(node, i);
+          if (ast.GetType(child) == ASTNode::STRING) {
+            Emit(Bytecode::PRINT_STRING, AddString(ast.GetStrValue(child)));
+          } else {
+            Emit(Bytecode::PRINT_NUMBER, CompileExpr(child));
+          }
+        }
+        Emit(Bytecode::PRINT_NEWLINE);
+        break;
+      case ASTNode::IF:
+        if (stage == 0) {
+          frame.jump = CompileJumpIfFalse(ast.GetChild(node, 0));
+          frames.push_back({ast.GetChild(node, 1), 0});
+          continue;
+        }
+        if (stage == 1 && ast.NumChildren(node) > 2) {
+          const size_t to_else = frame.jump;
+          frame.jump = Emit(Bytecode::JUMP);
+          PatchJump(to_else, Here());
+          frames.push_back({ast.GetChild(node, 2), 0});
+          continue;
+        }
+        if (stage == 1) PatchJump(frame.jump, Here());
+        else out.code[frame.jump].a = Here();
+        break;
+      case ASTNode::WHILE:
+        if (stage == 0) {
+          // A native version runs instead of the bytecode loop below when it is available.
+          size_t entry = 0;
+          frame.native = jit && jit->CompileLoop(node, entry);
+          if (frame.native) frame.native_pc = Emit(Bytecode::NATIVE_LOOP, static_cast<uint32_t>(entry));
+          frame.top = Here();
+          frame.jump = CompileJumpIfFalse(ast.GetChild(node, 0));
+          if (ast.NumChildren(node) > 1) {
+            frames.push_back({ast.GetChild(node, 1), 0});
+            continue;
+          }
+        }
+        Emit(Bytecode::JUMP, frame.top);
+        PatchJump(frame.jump, Here());
+        if (frame.native) out.code[frame.native_pc].b = Here();
+        break;
+      default:
+        CompileExpr(node);  // Expression statement; result discarded.
+        break;
+      }
+      frames.pop_back();
+    }
+  }
+
+  // Replace temporary placeholders with real register numbers.
+  void ResolveTemps() {
+    const uint32_t base = TempBase();
+    auto fix = [base](uint32_t & reg) { if (reg & TEMP_FLAG) reg = (reg & ~TEMP_FLAG) + base; };
+    for (auto & inst : out.code) {
+      switch (inst.op) {
+      case Bytecode::JUMP:
+      case Bytecode::NATIVE_LOOP:
+      case Bytecode::PRINT_STRING:
+      case Bytecode::PRINT_NEWLINE:
+      case Bytecode::HALT:
+        break;
+      case Bytecode::JUMP_IF_FALSE:
+      case Bytecode::JUMP_IF_TRUE:
+      case Bytecode::PRINT_NUMBER:
+        fix(inst.a);
+        break;
+      case Bytecode::JUMP_UNLESS_LESS:
+      case Bytecode::JUMP_UNLESS_LESS_EQUAL:
+      case Bytecode::JUMP_UNLESS_GREATER:
+      case Bytecode::JUMP_UNLESS_GREATER_EQUAL:
+      case Bytecode::JUMP_UNLESS_EQUAL:
+      case Bytecode::JUMP_UNLESS_NOT_EQUAL:
+      case Bytecode::JUMP_UNLESS_DIVISIBLE:
+        fix(inst.a); fix(inst.b);
+        break;
+      default:
+        fix(inst.a); fix(inst.b); fix(inst.c);
+      }
+    }
+    out.num_registers = base + max_temp;
+  }
+
+public:
+  BytecodeCompiler(Bytecode & out, const ASTArena & ast) : out(out), ast(ast) {
+    FindSideEffects();
+    FindIntegral(out.num_slots);
+  }
+
+  // With `use_jit`, loops that are purely numeric are also compiled to native code.
+  static Bytecode Compile(const ASTArena & ast, size_t num_slots, bool use_jit = false) {
+    Bytecode bytecode;
+    bytecode.num_slots = num_slots;
+    BytecodeCompiler compiler(bytecode, ast);
+    JitCompiler jit(ast);
+    if (use_jit) compiler.jit = &jit;
+    compiler.CompileStatement(ASTArena::ROOT);
+    compiler.Emit(Bytecode::HALT);
+    compiler.ResolveTemps();
+    bytecode.native = jit.Finish();
+    return bytecode;
+  }
+};
+
+
+/**
+ * Register-based virtual machine that executes Bytecode.
+ */
+class VM
+{
+private:
+  std::vector<double> regs{};
+  uint64_t fired[Bytecode::NUM_FUSIONS]{};   // Executions of fused instructions, when counted
+
+  static constexpr double INT64_LIMIT = 9223372036854775808.0;   // 2^63
+  static constexpr double EXACT_LIMIT = 9007199254740992.0;      // 2^53
+  static constexpr double MAX_INT_EXPONENT = 64;                 // Beyond 53, only 0 and +-1 stay exact
+
+  // fmod(x, y) for a whole y.  When x is also whole and both fit in int64, the int64 remainder
+  // is exact and has the same sign, so it is the same value; only a zero needs x's sign.
+  static double IntMod(double x, double y) {
+    if (std::fabs(x) < INT64_LIMIT && std::fabs(y) < INT64_LIMIT) {
+      const int64_t whole = static_cast<int64_t>(x);
+      if (static_cast<double>(whole) == x) {
+        const int64_t rem = whole % static_cast<int64_t>(y);
+        return rem ? static_cast<double>(rem) : std::copysign(0.0, x);
+      }
+    }
+    return std::fmod(x, y);
+  }
+
+  // pow(x, y) by repeated squaring when x is whole and y a small whole exponent.  Every
+  // partial product is at most the result, so a result within 2^53 was computed exactly.
+  static double IntPow(double x, double y) {
+    if (y >= 0 && y <= MAX_INT_EXPONENT && std::fabs(x) <= EXACT_LIMIT && x == std::trunc(x) && y == std::trunc(y)) {
+      double result = 1.0;
+      double base = x;
+      for (unsigned exp = static_cast<unsigned>(y); exp; ) {
+        if (exp & 1) result *= base;
+        exp >>= 1;
+        if (exp) base *= base;
+      }
+      if (std::fabs(result) <= EXACT_LIMIT) return result;
+    }
+    return std::pow(x, y);
+  }
+
+public:
+  // With COUNTED, also count how many times each kind of fused instruction runs.
+  template <bool COUNTED = false>
+  void Run(const Bytecode & bc, OutputSink & out) {
+    regs.assign(bc.num_registers, 0.0);
+    std::copy(bc.constants.begin(), bc.constants.end(), regs.begin() + bc.num_slots);
+
+    double * r = regs.data();
+    const Bytecode::Instruction * code = bc.code.data();
+    const NativeCode * native = bc.native.get();
+    const bool tagged = bc.fusions.size() == bc.code.size();
+    size_t pc = 0;
+
+    while (true) {
+      if constexpr (COUNTED) {
+        if (tagged) ++fired[bc.fusions[pc]];
+      }
+      const Bytecode::Instruction & inst = code[pc++];
+      switch (inst.op) {
+      case Bytecode::HALT: return;
+      case Bytecode::MOVE: r[inst.a] = r[inst.b]; break;
+      case Bytecode::ADD: r[inst.a] = r[inst.b] + r[inst.c]; break;
+      case Bytecode::SUB: r[inst.a] = r[inst.b] - r[inst.c]; break;
+      case Bytecode::MUL: r[inst.a] = r[inst.b] * r[inst.c]; break;
+      case Bytecode::DIV:
+        if (r[inst.c] == 0) RuntimeError("Division by zero.");
+        r[inst.a] = r[inst.b] / r[inst.c];
+        break;
+      case Bytecode::MOD:
+        if (r[inst.c] == 0) RuntimeError("Modulus by zero.");
+        r[inst.a] = std::fmod(r[inst.b], r[inst.c]);
+        break;
+      case Bytecode::POW: r[inst.a] = std::pow(r[inst.b], r[inst.c]); break;
+      case Bytecode::DIV_NONZERO: r[inst.a] = r[inst.b] / r[inst.c]; break;
+      case Bytecode::MOD_NONZERO: r[inst.a] = std::fmod(r[inst.b], r[inst.c]); break;
+      case Bytecode::MOD_INT:
+        if (r[inst.c] == 0) RuntimeError("Modulus by zero.");
+        [[fallthrough]];
+      case Bytecode::MOD_INT_NONZERO: r[inst.a] = IntMod(r[inst.b], r[inst.c]); break;
+      case Bytecode::POW_INT: r[inst.a] = IntPow(r[inst.b], r[inst.c]); break;
+      case Bytecode::LESS: r[inst.a] = r[inst.b] < r[inst.c] ? 1.0 : 0.0; break;
+      case Bytecode::LESS_EQUAL: r[inst.a] = r[inst.b] <= r[inst.c] ? 1.0 : 0.0; break;
+      case Bytecode::GREATER: r[inst.a] = r[inst.b] > r[inst.c] ? 1.0 : 0.0; break;
+      case Bytecode::GREATER_EQUAL: r[inst.a] = r[inst.b] >= r[inst.c] ? 1.0 : 0.0; break;
+      case Bytecode::EQUAL: r[inst.a] = r[inst.b] == r[inst.c] ? 1.0 : 0.0; break;
+      case Bytecode::NOT_EQUAL: r[inst.a] = r[inst.b] != r[inst.c] ? 1.0 : 0.0; break;
+      case Bytecode::NEGATE: r[inst.a] = r[inst.b] * -1; break;
+      case Bytecode::NOT: r[inst.a] = r[inst.b] == 0.0 ? 1.0 : 0.0; break;
+      case Bytecode::TO_BOOL: r[inst.a] = r[inst.b] != 0.0 ? 1.0 : 0.0; break;
+      case Bytecode::JUMP: pc = inst.a; break;
+      case Bytecode::JUMP_IF_FALSE: if (r[inst.a] == 0.0) pc = inst.b; break;
+      case Bytecode::JUMP_IF_TRUE: if (r[inst.a] != 0.0) pc = inst.b; break;
+      case Bytecode::JUMP_UNLESS_LESS: if (!(r[inst.a] < r[inst.b])) pc = inst.c; break;
+      case Bytecode::JUMP_UNLESS_LESS_EQUAL: if (!(r[inst.a] <= r[inst.b])) pc = inst.c; break;
+      case Bytecode::JUMP_UNLESS_GREATER: if (!(r[inst.a] > r[inst.b])) pc = inst.c; break;
+      case Bytecode::JUMP_UNLESS_GREATER_EQUAL: if (!(r[inst.a] >= r[inst.b])) pc = inst.c; break;
+      case Bytecode::JUMP_UNLESS_EQUAL: if (!(r[inst.a] == r[inst.b])) pc = inst.c; break;
+      case Bytecode::JUMP_UNLESS_NOT_EQUAL: if (!(r[inst.a] != r[inst.b])) pc = inst.c; break;
+      case Bytecode::JUMP_UNLESS_DIVISIBLE: if (IntMod(r[inst.a], r[inst.b]) != 0.0) pc = inst.c; break;
+      case Bytecode::PRINT_STRING: out.Write(bc.strings[inst.a]); break;
+      case Bytecode::PRINT_NUMBER: out.WriteNumber(r[inst.a]); break;
+      case Bytecode::PRINT_NEWLINE: out.Write('\n'); break;
+      case Bytecode::NATIVE_LOOP:
+        if (!native) break;
+        switch (native->Call(inst.a, r)) {
+        case NativeCode::DIVISION_BY_ZERO: RuntimeError("Division by zero.");
+        case NativeCode::MODULUS_BY_ZERO: RuntimeError("Modulus by zero.");
+        }
+        pc = inst.b;
+        break;
+      }
+    }
+  }
+
+  // Executions of each kind of fused instruction over all counted runs.
+  uint64_t GetFired(Bytecode::Fusion fusion) const { return fired[fusion]; }
+};
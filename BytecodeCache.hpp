@@ -0,0 +1,246 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Bytecode.hpp"
+#include "SourceBuffer.hpp"
+
+// Identifies the interpreter build.  Defaults to the compile time, so every rebuild starts with
+// an empty cache and memo; reproducible builds can define it as, e.g., a hash of the sources.
+#ifndef MACROCALC_BUILD_ID
+#define MACROCALC_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+/**
+ * On-disk cache of compiled programs, so a script that has not changed skips lexing, parsing,
+ * optimizing and bytecode compilation.
+ * Each entry is one file named by a hash of the source text, the build id, the format version
+ * and the compile options, so a rebuilt compiler never reuses what an older one produced.  The file is a flat image meant to be read straight from a mapping:
+ *   Header | code (4 x uint32 per instruction) | constants (double) | string offsets (uint64,
+ *   one more than there are strings) | string bytes
+ * Every section starts on an 8-byte boundary.  Anything unexpected in a file (wrong magic,
+ * version, build id, source hash or size, a body that fails its checksum, out-of-range operands) makes
+ * Load() report a miss, and the caller just compiles again.  Native (JIT) code holds process addresses and is never cached.
+ */
+class BytecodeCache
+{
+private:
+  static constexpr char MAGIC[8] = {'M', 'C', 'B', 'C', 'O', 'D', 'E', '\0'};
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t build_id;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint64_t num_slots;
+    uint64_t num_registers;
+    uint64_t num_code;
+    uint64_t num_constants;
+    uint64_t num_strings;
+    uint64_t string_bytes;
+    uint64_t body_hash;        // Hash of everything after the header, to catch damaged files
+  };
+  static_assert(sizeof(Header) % 8 == 0);
+
+  std::filesystem::path dir;
+  uint64_t build_id;
+
+  static size_t Pad8(size_t size) { return (size + 7) & ~size_t{7}; }
+
+  // Are all of an instruction's operands in range for this program?
+  static bool Valid(const Bytecode & bc, const Bytecode::Instruction & inst) {
+    const size_t regs = bc.num_registers;
+    switch (inst.op) {
+    case Bytecode::HALT:
+    case Bytecode::PRINT_NEWLINE:
+      return true;
+    case Bytecode::MOVE:
+    case Bytecode::NEGATE:
+    case Bytecode::NOT:
+    case Bytecode::TO_BOOL:
+      return inst.a < regs && inst.b < regs;
+    case Bytecode::JUMP:
+      return inst.a < bc.code.size();
+    case Bytecode::JUMP_IF_FALSE:
+    case Bytecode::JUMP_IF_TRUE:
+      return inst.a < regs && inst.b < bc.code.size();
+    case Bytecode::JUMP_UNLESS_LESS:
+    case Bytecode::JUMP_UNLESS_LESS_EQUAL:
+    case Bytecode::JUMP_UNLESS_GREATER:
+    case Bytecode::JUMP_UNLESS_GREATER_EQUAL:
+    case Bytecode::JUMP_UNLESS_EQUAL:
+    case Bytecode::JUMP_UNLESS_NOT_EQUAL:
+    case Bytecode::JUMP_UNLESS_DIVISIBLE:
+      return inst.a < regs && inst.b < regs && inst.c < bc.code.size();
+    case Bytecode::PRINT_STRING:
+      return inst.a < bc.strings.size();
+    case Bytecode::PRINT_NUMBER:
+      return inst.a < regs;
+    case Bytecode::NATIVE_LOOP:
+      return false;
+    default:
+      return inst.op <= Bytecode::NOT_EQUAL && inst.a < regs && inst.b < regs && inst.c < regs;
+    }
+  }
+
+public:
+  // Bump whenever the image layout changes.  Compiler changes are covered by the build id.
+  static constexpr uint32_t FORMAT_VERSION = 4;
+  static constexpr uint32_t FLAG_OPTIMIZED = 1;
+
+  // `build_id` is only overridden by tests that stand in for another build.
+  explicit BytecodeCache(std::filesystem::path dir, uint64_t build_id = BuildId())
+    : dir(std::move(dir)), build_id(build_id) { }
+
+  // 64-bit FNV-1a.
+  static uint64_t Hash(std::string_view text) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c : text) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  static uint64_t BuildId() {
+    static const uint64_t id = Hash(MACROCALC_BUILD_ID);
+    return id;
+  }
+
+  std::filesystem::path EntryPath(uint64_t source_hash, uint32_t flags) const {
+    char name[32];
+    const uint64_t key = source_hash ^ (build_id + (uint64_t{FORMAT_VERSION} << 32 | flags)) * 0x9e3779b97f4a7c15ull;
+    std::snprintf(name, sizeof(name), "%016llx.mcbc", static_cast<unsigned long long>(key));
+    return dir / name;
+  }
+
+  // Fill `bc` from the cached image for `source`, if there is a valid one.
+  bool Load(std::string_view source, uint32_t flags, Bytecode & bc) const {
+    const uint64_t source_hash = Hash(source);
+    SourceBuffer image;
+    if (!image.Load(EntryPath(source_hash, flags).string())) return false;
+    const std::string_view data = image.View();
+
+    Header header;
+    if (data.size() < sizeof(Header)) return false;
+    std::memcpy(&header, data.data(), sizeof(Header));
+    if (header.num_strings >= data.size()) return false;
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != FORMAT_VERSION
+        || header.flags != flags || header.build_id != build_id || header.source_hash != source_hash
+        || header.source_size != source.size() || header.body_hash != Hash(data.substr(sizeof(Header)))) {
+      return false;
+    }
+
+    // Check each section fits before reading it; sizes are bounded by the file size.
+    size_t pos = sizeof(Header);
+    auto section = [&](uint64_t count, size_t width, size_t & start) {
+      if (count > data.size() / width || pos + count * width > data.size()) return false;
+      start = pos;
+      pos += Pad8(count * width);
+      return true;
+    };
+    size_t code_pos, const_pos, offset_pos, string_pos;
+    if (!section(header.num_code, 4 * sizeof(uint32_t), code_pos)
+        || !section(header.num_constants, sizeof(double), const_pos)
+        || !section(header.num_strings + 1, sizeof(uint64_t), offset_pos)
+        || !section(header.string_bytes, 1, string_pos)) {
+      return false;
+    }
+    if (header.num_code == 0 || header.num_slots + header.num_constants > header.num_registers) return false;
+
+    bc = Bytecode{};
+    bc.num_slots = header.num_slots;
+    bc.num_registers = header.num_registers;
+    bc.constants.resize(header.num_constants);
+    std::memcpy(bc.constants.data(), data.data() + const_pos, header.num_constants * sizeof(double));
+
+    std::vector<uint64_t> offsets(header.num_strings + 1);
+    std::memcpy(offsets.data(), data.data() + offset_pos, offsets.size() * sizeof(uint64_t));
+    bc.strings.reserve(header.num_strings);
+    for (size_t i = 0; i < header.num_strings; ++i) {
+      if (offsets[i] > offsets[i + 1] || offsets[i + 1] > header.string_bytes) return false;
+      bc.strings.emplace_back(data.substr(string_pos + offsets[i], offsets[i + 1] - offsets[i]));
+    }
+
+    bc.code.resize(header.num_code);
+    for (size_t i = 0; i < header.num_code; ++i) {
+      uint32_t fields[4];
+      std::memcpy(fields, data.data() + code_pos + i * sizeof(fields), sizeof(fields));
+      bc.code[i] = {static_cast<Bytecode::Op>(fields[0]), fields[1], fields[2], fields[3]};
+      if (fields[0] > Bytecode::NATIVE_LOOP) return false;
+    }
+    for (const auto & inst : bc.code) {
+      if (!Valid(bc, inst)) return false;
+    }
+    return bc.code.back().op == Bytecode::HALT;
+  }
+
+  // Save `bc` as the entry for `source`.  Failures are ignored: the cache is only an accelerator.
+  void Store(std::string_view source, uint32_t flags, const Bytecode & bc) const {
+    if (bc.native) return;
+
+    std::string image;
+    auto append = [&image](const void * data, size_t size) {
+      image.append(static_cast<const char *>(data), size);
+      image.resize(Pad8(image.size()), '\0');
+    };
+
+    std::vector<uint64_t> offsets{0};
+    for (const std::string & str : bc.strings) offsets.push_back(offsets.back() + str.size());
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.flags = flags;
+    header.build_id = build_id;
+    header.source_hash = Hash(source);
+    header.source_size = source.size();
+    header.num_slots = bc.num_slots;
+    header.num_registers = bc.num_registers;
+    header.num_code = bc.code.size();
+    header.num_constants = bc.constants.size();
+    header.num_strings = bc.strings.size();
+    header.string_bytes = offsets.back();
+    append(&header, sizeof(header));   // body_hash is filled in once the body is written
+
+    std::vector<uint32_t> code;
+    code.reserve(bc.code.size() * 4);
+    for (const auto & inst : bc.code) code.insert(code.end(), {inst.op, inst.a, inst.b, inst.c});
+    append(code.data(), code.size() * sizeof(uint32_t));
+    append(bc.constants.data(), bc.constants.size() * sizeof(double));
+    append(offsets.data(), offsets.size() * sizeof(uint64_t));
+    std::string strings;
+    for (const std::string & str : bc.strings) strings += str;
+    append(strings.data(), strings.size());
+    header.body_hash = Hash(std::string_view(image).substr(sizeof(header)));
+    std::memcpy(image.data(), &header, sizeof(header));
+
+    // Write to a private temporary and rename it into place, so concurrent runs never see a
+    // partial file.
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    const std::filesystem::path path = EntryPath(header.source_hash, flags);
+    std::filesystem::path temp = path;
+    temp += ".tmp" + std::to_string(std::random_device{}());
+    {
+      std::ofstream file(temp, std::ios::binary);
+      if (!file.write(image.data(), static_cast<std::streamsize>(image.size()))) {
+        file.close();
+        std::filesystem::remove(temp, error);
+        return;
+      }
+    }
+    std::filesystem::rename(temp, path, error);
+    if (error) std::filesystem::remove(temp, error);
+  }
+};
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ASTArena.hpp"
+#include "ASTNode.hpp"
+#include "MacroCalcError.hpp"
+#include "OutputSink.hpp"
+
+/**
+ * Closure-compiled form of a program.
+ * Each AST node is compiled once into a Closure: a handler function pointer plus everything
+ * that handler needs, already resolved (operator, operand slots, literal values, children).
+ * Running a closure is a single indirect call, with no switch on the node type and no operator
+ * lookup.  Common leaf shapes get their own handlers, so `x + 1`, `x < y` or `i <= 10` read
+ * their operands straight from the frame without calling into child closures.
+ */
+class ClosureProgram
+{
+public:
+  struct Context {
+    double * frame;     // Variable values, by slot
+    OutputSink & out;
+  };
+
+  struct Closure;
+  using Handler = double (*)(const Closure &, Context &);
+
+  struct Closure {
+    Handler fn{nullptr};
+    const Closure * a{nullptr};               // Operands / children, by position
+    const Closure * b{nullptr};
+    const Closure * c{nullptr};
+    const Closure * const * list{nullptr};    // Statements of a scope or parts of a print
+    uint32_t count{0};
+    uint32_t slot{0};                         // Frame slots for variable operands
+    uint32_t slot2{0};
+    double value{0.0};                        // Literal operand
+    std::string_view text{};                  // Print text
+
+    double operator()(Context & ctx) const { return fn(*this, ctx); }
+  };
+
+private:
+  // Storage is reserved up front from the node count, so closures never move once created.
+  std::vector<Closure> closures{};
+  std::vector<const Closure *> lists{};
+  std::deque<std::string> strings{};        // Print text owned by the program
+  std::vector<double> frame{};
+  const Closure * entry{nullptr};
+
+  // -- Operators --
+  // Each one applies an operator to two values exactly as MacroCalc::Run does.
+
+  struct Add { static double Apply(double l, double r, Context &) { return l + r; } };
+  struct Sub { static double Apply(double l, double r, Context &) { return l - r; } };
+  struct Mul { static double Apply(double l, double r, Context &) { return l * r; } };
+  struct Div {
+    static double Apply(double l, double r, Context &) {
+      if (r == 0) RuntimeError("Division by zero.");
+      return l / r;
+    }
+  };
+  struct Mod {
+    static double Apply(double l, double r, Context &) {
+      if (r == 0) RuntimeError("Modulus by zero.");
+      return std::fmod(l, r);
+    }
+  };
+  struct Pow { static double Apply(double l, double r, Context &) { return std::pow(l, r); } };
+  struct Less { static double Apply(double l, double r, Context &) { return l < r ? 1.0 : 0.0; } };
+  struct LessEqual { static double Apply(double l, double r, Context &) { return l <= r ? 1.0 : 0.0; } };
+  struct Greater { static double Apply(double l, double r, Context &) { return l > r ? 1.0 : 0.0; } };
+  struct GreaterEqual { static double Apply(double l, double r, Context &) { return l >= r ? 1.0 : 0.0; } };
+  struct Equal { static double Apply(double l, double r, Context &) { return l == r ? 1.0 : 0.0; } };
+  struct NotEqual { static double Apply(double l, double r, Context &) { return l != r ? 1.0 : 0.0; } };
+
+  // -- Handlers --
+
+  static double Constant(const Closure & c, Context &) { return c.value; }
+  static double Variable(const Closure & c, Context & ctx) { return ctx.frame[c.slot]; }
+
+  // Generic binary operator: evaluate the lhs fully before the rhs.
+  template <typename OP> static double Binary(const Closure & c, Context & ctx) {
+    const double lhs = (*c.a)(ctx);
+    return OP::Apply(lhs, (*c.b)(ctx), ctx);
+  }
+  template <typename OP> static double BinaryVarConst(const Closure & c, Context & ctx) {
+    return OP::Apply(ctx.frame[c.slot], c.value, ctx);
+  }
+  template <typename OP> static double BinaryConstVar(const Closure & c, Context & ctx) {
+    return OP::Apply(c.value, ctx.frame[c.slot], ctx);
+  }
+  template <typename OP> static double BinaryVarVar(const Closure & c, Context & ctx) {
+    return OP::Apply(ctx.frame[c.slot], ctx.frame[c.slot2], ctx);
+  }
+
+  static double And(const Closure & c, Context & ctx) {
+    if ((*c.a)(ctx) == 0.0) return 0.0;
+    return (*c.b)(ctx) != 0.0 ? 1.0 : 0.0;
+  }
+  static double Or(const Closure & c, Context & ctx) {
+    if ((*c.a)(ctx) != 0.0) return 1.0;
+    return (*c.b)(ctx) != 0.0 ? 1.0 : 0.0;
+  }
+  static double Negate(const Closure & c, Context & ctx) { return (*c.a)(ctx) * -1; }
+  static double Not(const Closure & c, Context & ctx) { return (*c.a)(ctx) == 0.0 ? 1.0 : 0.0; }
+
+  static double Assign(const Closure & c, Context & ctx) {
+    return ctx.frame[c.slot] = (*c.a)(ctx);
+  }
+  static double AssignConst(const Closure & c, Context & ctx) {
+    return ctx.frame[c.slot] = c.value;
+  }
+
+  static double Scope(const Closure & c, Context & ctx) {
+    for (uint32_t i = 0; i < c.count; ++i) (*c.list[i])(ctx);
+    return 0.0;
+  }
+  static double If(const Closure & c, Context & ctx) {
+    if ((*c.a)(ctx) != 0.0) return (*c.b)(ctx);
+    return c.c ? (*c.c)(ctx) : 0.0;
+  }
+  static double While(const Closure & c, Context & ctx) {
+    while ((*c.a)(ctx) != 0.0) (*c.b)(ctx);
+    return 0.0;
+  }
+  static double WhileNoBody(const Closure & c, Context & ctx) {
+    while ((*c.a)(ctx) != 0.0) { }
+    return 0.0;
+  }
+
+  // Print parts, each run in order by Print.
+  static double PrintText(const Closure & c, Context & ctx) { ctx.out.Write(c.text); return 0.0; }
+  static double PrintVariable(const Closure & c, Context & ctx) {
+    ctx.out.WriteNumber(ctx.frame[c.slot]);
+    return 0.0;
+  }
+  static double PrintExpr(const Closure & c, Context & ctx) {
+    ctx.out.WriteNumber((*c.a)(ctx));
+    return 0.0;
+  }
+  static double Print(const Closure & c, Context & ctx) {
+    for (uint32_t i = 0; i < c.count; ++i) (*c.list[i])(ctx);
+    ctx.out.Write('\n');
+    return 0.0;
+  }
+
+  // -- Compilation --
+
+  Closure & NewClosure(Handler fn) {
+    assert(closures.size() < closures.capacity());   // Growing would move existing closures.
+    closures.push_back(Closure{});
+    closures.back().fn = fn;
+    return closures.back();
+  }
+
+  const Closure * const * NewList(const std::vector<const Closure *> & items) {
+    assert(lists.size() + items.size() <= lists.capacity());
+    const size_t start = lists.size();
+    lists.insert(lists.end(), items.begin(), items.end());
+    return lists.data() + start;
+  }
+
+  static bool IsVariable(const ASTNode & node) { return node.GetType() == ASTNode::VARIABLE; }
+  static bool IsNumber(const ASTNode & node) { return node.GetType() == ASTNode::NUMBER; }
+
+  // Skip PARENTH wrappers (only present when the optimizer did not run).
+  static const ASTNode & Unwrap(const ASTNode & node) {
+    const ASTNode * cur = &node;
+    while (cur->GetType() == ASTNode::PARENTH) cur = &cur->GetChild(0);
+    return *cur;
+  }
+
+  template <typename OP> const Closure * CompileBinaryAs(const ASTNode & node) {
+    const ASTNode & lhs = Unwrap(node.GetChild(0));
+    const ASTNode & rhs = Unwrap(node.GetChild(1));
+    if (IsVariable(lhs) && IsNumber(rhs)) {
+      Closure & c = NewClosure(BinaryVarConst<OP>);
+      c.slot = static_cast<uint32_t>(lhs.GetVarID());
+      c.value = rhs.GetValue();
+      return &c;
+    }
+    if (IsNumber(lhs) && IsVariable(rhs)) {
+      Closure & c = NewClosure(BinaryConstVar<OP>);
+      c.value = lhs.GetValue();
+      c.slot = static_cast<uint32_t>(rhs.GetVarID());
+      return &c;
+    }
+    if (IsVariable(lhs) && IsVariable(rhs)) {
+      Closure & c = NewClosure(BinaryVarVar<OP>);
+      c.slot = static_cast<uint32_t>(lhs.GetVarID());
+      c.slot2 = static_cast<uint32_t>(rhs.GetVarID());
+      return &c;
+    }
+    const Closure * a = Compile(lhs);
+    const Closure * b = Compile(rhs);
+    Closure & c = NewClosure(Binary<OP>);
+    c.a = a;
+    c.b = b;
+    return &c;
+  }
+
+  const Closure * CompileBinary(const ASTNode & node) {
+    using L = emplex::Lexer;
+    switch (node.GetOp()) {
+    case L::ID_PLUS: return CompileBinaryAs<Add>(node);
+    case L::ID_MINUS: return CompileBinaryAs<Sub>(node);
+    case L::ID_TIMES: return CompileBinaryAs<Mul>(node);
+    case L::ID_DIVIDE: return CompileBinaryAs<Div>(node);
+    case L::ID_MODULUS: return CompileBinaryAs<Mod>(node);
+    case L::ID_POWER: return CompileBinaryAs<Pow>(node);
+    case L::ID_LESS: return CompileBinaryAs<Less>(node);
+    case L::ID_LESS_EQUAL: return CompileBinaryAs<LessEqual>(node);
+    case L::ID_GREATER: return CompileBinaryAs<Greater>(node);
+    case L::ID_GREATER_EQUAL: return CompileBinaryAs<GreaterEqual>(node);
+    case L::ID_EQUAL: return CompileBinaryAs<Equal>(node);
+    case L::ID_NOT_EQUAL: return CompileBinaryAs<NotEqual>(node);
+    }
+    RuntimeError("Unknown operator '" + node.GetStrValue() + "'.");
+  }
+
+  const Closure * CompileList(const ASTNode & node, Handler fn) {
+    std::vector<const Closure *> items;
+    items.reserve(node.GetChildren().size());
+    for (const ASTNode & child : node.GetChildren()) {
+      if (fn == Print) items.push_back(CompilePrintPart(child));
+      else items.push_back(Compile(child));
+    }
+    Closure & c = NewClosure(fn);
+    c.list = NewList(items);
+    c.count = static_cast<uint32_t>(items.size());
+    return &c;
+  }
+
+  const Closure * CompilePrintPart(const ASTNode & part) {
+    if (part.GetType() == ASTNode::STRING) {
+      Closure & c = NewClosure(PrintText);
+      c.text = strings.emplace_back(part.GetStrValue());
+      return &c;
+    }
+    if (IsVariable(part)) {
+      Closure & c = NewClosure(PrintVariable);
+      c.slot = static_cast<uint32_t>(part.GetVarID());
+      return &c;
+    }
+    const Closure * a = Compile(part);
+    Closure & c = NewClosure(PrintExpr);
+    c.a = a;
+    return &c;
+  }
+
+  const Closure * Compile(const ASTNode & node) {
+    switch (node.GetType()) {
+    case ASTNode::SCOPE:
+      return CompileList(node, Scope);
+    case ASTNode::PRINT:
+      return CompileList(node, Print);
+    case ASTNode::NUMBER: {
+      Closure & c = NewClosure(Constant);
+      c.value = node.GetValue();
+      return &c;
+    }
+    case ASTNode::VARIABLE: {
+      Closure & c = NewClosure(Variable);
+      c.slot = static_cast<uint32_t>(node.GetVarID());
+      return &c;
+    }
+    case ASTNode::PARENTH:
+      return Compile(node.GetChild(0));
+    case ASTNode::ASSIGN: {
+      const ASTNode & rhs = Unwrap(node.GetChild(1));
+      const uint32_t slot = static_cast<uint32_t>(node.GetChild(0).GetVarID());
+      if (IsNumber(rhs)) {
+        Closure & c = NewClosure(AssignConst);
+        c.slot = slot;
+        c.value = rhs.GetValue();
+        return &c;
+      }
+      const Closure * a = Compile(rhs);
+      Closure & c = NewClosure(Assign);
+      c.slot = slot;
+      c.a = a;
+      return &c;
+    }
+    case ASTNode::IF: {
+      const Closure * a = Compile(node.GetChild(0));
+      const Closure * b = Compile(node.GetChild(1));
+      const Closure * else_branch = node.GetChildren().size() > 2 ? Compile(node.GetChild(2)) : nullptr;
+      Closure & c = NewClosure(If);
+      c.a = a;
+      c.b = b;
+      c.c = else_branch;
+      return &c;
+    }
+    case ASTNode::WHILE: {
+      // A while loop may have no body at all, e.g. `while ((x = x * 2) < 100);`
+      const Closure * a = Compile(node.GetChild(0));
+      const Closure * b = node.GetChildren().size() > 1 ? Compile(node.GetChild(1)) : nullptr;
+      Closure & c = NewClosure(b ? While : WhileNoBody);
+      c.a = a;
+      c.b = b;
+      return &c;
+    }
+    case ASTNode::MATH_OP:
+    case ASTNode::COMP_OP:
+      return CompileBinary(node);
+    case ASTNode::LOGICAL_OP: {
+      const Closure * a = Compile(node.GetChild(0));
+      const Closure * b = Compile(node.GetChild(1));
+      Closure & c = NewClosure(node.GetOp() == emplex::Lexer::ID_AND ? And : Or);
+      c.a = a;
+      c.b = b;
+      return &c;
+    }
+    case ASTNode::MODIFIER: {
+      const Closure * a = Compile(node.GetChild(0));
+      Closure & c = NewClosure(node.GetOp() == emplex::Lexer::ID_MINUS ? Negate : Not);
+      c.a = a;
+      return &c;
+    }
+    default: {
+      // Anything else evaluates to zero, as in MacroCalc::Run.
+      Closure & c = NewClosure(Constant);
+      return &c;
+    }
+    }
+  }
+
+public:
+  // Compile a whole program; `num_slots` is the size of the variable frame.
+  ClosureProgram(const ASTNode & root, size_t num_slots) : frame(num_slots, 0.0) {
+    // Every node yields at most one closure, plus a print-part wrapper if it is a print
+    // argument; every list entry is a child of some node.  So the node count bounds both tables.
+    const size_t num_nodes = ASTArena::CountNodes(root);
+    closures.reserve(2 * num_nodes + 1);
+    lists.reserve(num_nodes);
+    entry = Compile(root);
+  }
+  ClosureProgram(const ClosureProgram &) = delete;
+  ClosureProgram & operator=(const ClosureProgram &) = delete;
+
+  size_t size() const { return closures.size(); }
+
+  void Run(OutputSink & out) {
+    std::fill(frame.begin(), frame.end(), 0.0);
+    Context ctx{frame.data(), out};
+    (*entry)(ctx);
+  }
+};
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "ASTNode.hpp"
+
+/**
+ * Lowers a parsed (and usually optimized) AST to a standalone C++ translation unit that does
+ * exactly what MacroCalc::Run would: same PRINT formatting, short-circuit && and ||, the same
+ * division/modulus-by-zero errors, and std::pow for **.
+ * Variables become locals named after their frame slot (s0, s1, ...).  C++ leaves the order of
+ * operand evaluation unspecified, so when either operand assigns, the left operand is saved
+ * into a temporary first and evaluation stays strictly left to right.
+ */
+class CppEmitter
+{
+private:
+  std::string body{};
+  size_t num_temps{0};
+  int indent{1};
+
+  // Runtime support copied into every generated program; formatting matches OutputSink.
+  static constexpr std::string_view PRELUDE = R"(// Generated by Project2 --emit-cpp; do not edit.
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+char mc_buffer[64 * 1024];
+size_t mc_used = 0;
+
+void mc_flush() {
+  std::fwrite(mc_buffer, 1, mc_used, stdout);
+  std::fflush(stdout);
+  mc_used = 0;
+}
+void mc_write(const char * text, size_t size) {
+  if (mc_used + size > sizeof(mc_buffer)) {
+    mc_flush();
+    if (size > sizeof(mc_buffer)) { std::fwrite(text, 1, size, stdout); return; }
+  }
+  for (size_t i = 0; i < size; ++i) mc_buffer[mc_used++] = text[i];
+}
+void mc_number(double value) {
+  char digits[32];
+  char * end;
+  if (value == std::trunc(value) && std::fabs(value) < 1e6 && !(value == 0 && std::signbit(value))) {
+    end = std::to_chars(digits, digits + 32, static_cast<long>(value)).ptr;
+  } else {
+    end = std::to_chars(digits, digits + 32, value, std::chars_format::general, 6).ptr;
+  }
+  mc_write(digits, static_cast<size_t>(end - digits));
+}
+[[noreturn]] void mc_error(const char * message) {
+  mc_flush();
+  std::fputs(message, stderr);
+  std::exit(1);
+}
+inline double mc_div(double lhs, double rhs) {
+  if (rhs == 0) mc_error("ERROR: Division by zero.\n");
+  return lhs / rhs;
+}
+inline double mc_mod(double lhs, double rhs) {
+  if (rhs == 0) mc_error("ERROR: Modulus by zero.\n");
+  return std::fmod(lhs, rhs);
+}
+}  // namespace
+
+)";
+
+  static bool HasSideEffects(const ASTNode & node) {
+    if (node.GetType() == ASTNode::ASSIGN) return true;
+    for (const ASTNode & child : node.GetChildren()) {
+      if (HasSideEffects(child)) return true;
+    }
+    return false;
+  }
+
+  static std::string Slot(const ASTNode & var) { return "s" + std::to_string(var.GetVarID()); }
+
+  // A double literal that reads back as exactly the same value.
+  static std::string Literal(double value) {
+    if (std::isnan(value)) {
+      return std::signbit(value) ? "(-std::numeric_limits<double>::quiet_NaN())"
+                                 : "std::numeric_limits<double>::quiet_NaN()";
+    }
+    if (std::isinf(value)) {
+      return value < 0 ? "(-std::numeric_limits<double>::infinity())"
+                       : "std::numeric_limits<double>::infinity()";
+    }
+    char digits[32];
+    std::string text(digits, std::to_chars(digits, digits + 32, value).ptr);
+    if (text.find_first_of(".e") == std::string::npos) text += ".0";
+    return value < 0 || std::signbit(value) ? "(" + text + ")" : text;
+  }
+
+  static std::string Quote(const std::string & text) {
+    std::string out = "\"";
+    for (const char c : text) {
+      switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      case '\r': out += "\\r"; break;
+      case '?': out += "\\?"; break;   // Avoid trigraphs
+      default: out += c;
+      }
+    }
+    return out + "\"";
+  }
+
+  std::string NewTemp() { return "t" + std::to_string(num_temps++); }
+
+  // Emit `lhs OP rhs` where `combine` builds the final expression from the two operand texts.
+  template <typename FN>
+  std::string Binary(const ASTNode & node, FN combine) {
+    std::string lhs = Expr(node.GetChild(0));
+    std::string rhs = Expr(node.GetChild(1));
+    if (!HasSideEffects(node.GetChild(0)) && !HasSideEffects(node.GetChild(1))) return combine(lhs, rhs);
+    const std::string temp = NewTemp();
+    return "(" + temp + " = " + lhs + ", " + combine(temp, rhs) + ")";
+  }
+
+  std::string Expr(const ASTNode & node) {
+    using L = emplex::Lexer;
+    switch (node.GetType()) {
+    case ASTNode::NUMBER:
+      return Literal(node.GetValue());
+    case ASTNode::VARIABLE:
+      return Slot(node);
+    case ASTNode::PARENTH:
+      return Expr(node.GetChild(0));
+    case ASTNode::ASSIGN:
+      return "(" + Slot(node.GetChild(0)) + " = " + Expr(node.GetChild(1)) + ")";
+    case ASTNode::MATH_OP:
+    case ASTNode::COMP_OP: {
+      const char * infix = nullptr;
+      const char * call = nullptr;
+      bool compare = (node.GetType() == ASTNode::COMP_OP);
+      switch (node.GetOp()) {
+      case L::ID_PLUS: infix = " + "; break;
+      case L::ID_MINUS: infix = " - "; break;
+      case L::ID_TIMES: infix = " * "; break;
+      case L::ID_DIVIDE: call = "mc_div"; break;
+      case L::ID_MODULUS: call = "mc_mod"; break;
+      case L::ID_POWER: call = "std::pow"; break;
+      case L::ID_LESS: infix = " < "; break;
+      case L::ID_LESS_EQUAL: infix = " <= "; break;
+      case L::ID_GREATER: infix = " > "; break;
+      case L::ID_GREATER_EQUAL: infix = " >= "; break;
+      case L::ID_EQUAL: infix = " == "; break;
+      case L::ID_NOT_EQUAL: infix = " != "; break;
+      default: return "0.0";
+      }
+      return Binary(node, [&](const std::string & lhs, const std::string & rhs) {
+        if (call) return std::string(call) + "(" + lhs + ", " + rhs + ")";
+        if (compare) return "(" + lhs + infix + rhs + " ? 1.0 : 0.0)";
+        return "(" + lhs + infix + rhs + ")";
+      });
+    }
+    case ASTNode::LOGICAL_OP: {
+      const std::string lhs = Expr(node.GetChild(0));
+      const std::string rhs = "(" + Expr(node.GetChild(1)) + " != 0.0 ? 1.0 : 0.0)";
+      if (node.GetOp() == L::ID_AND) return "(" + lhs + " != 0.0 ? " + rhs + " : 0.0)";
+      return "(" + lhs + " != 0.0 ? 1.0 : " + rhs + ")";
+    }
+    case ASTNode::MODIFIER: {
+      const std::string child = Expr(node.GetChild(0));
+      if (node.GetOp() == L::ID_MINUS) return "(" + child + " * -1.0)";
+      return "(" + child + " == 0.0 ? 1.0 : 0.0)";
+    }
+    default:
+      return "0.0";   // Anything else evaluates to zero, as in MacroCalc::Run.
+    }
+  }
+
+  void Line(const std::string & text) {
+    body.append(static_cast<size_t>(indent) * 2, ' ');
+    body += text;
+    body += '\n';
+  }
+
+  void Statement(const ASTNode & node) {
+    switch (node.GetType()) {
+    case ASTNode::EMPTY:
+      return;
+    case ASTNode::SCOPE:
+      Line("{");
+      ++indent;
+      for (const ASTNode & child : node.GetChildren()) Statement(child);
+      --indent;
+      Line("}");
+      return;
+    case ASTNode::PRINT:
+      for (const ASTNode & child : node.GetChildren()) {
+        if (child.GetType() == ASTNode::STRING) {
+          const std::string & text = child.GetStrValue();
+          Line("mc_write(" + Quote(text) + ", " + std::to_string(text.size()) + ");");
+        } else {
+          Line("mc_number(" + Expr(child) + ");");
+        }
+      }
+      Line("mc_write(\"\\n\", 1);");
+      return;
+    case ASTNode::IF:
+      Line("if (" + Expr(node.GetChild(0)) + " != 0.0) {");
+      ++indent;
+      Statement(node.GetChild(1));
+      --indent;
+      if (node.GetChildren().size() > 2) {
+        Line("} else {");
+        ++indent;
+        Statement(node.GetChild(2));
+        --indent;
+      }
+      Line("}");
+      return;
+    case ASTNode::WHILE:
+      Line("while (" + Expr(node.GetChild(0)) + " != 0.0) {");
+      ++indent;
+      if (node.GetChildren().size() > 1) Statement(node.GetChild(1));
+      --indent;
+      Line("}");
+      return;
+    default:
+      Line("(void) " + Expr(node) + ";");   // Expression statement; result discarded.
+      return;
+    }
+  }
+
+public:
+  // Write a complete program for `root`, whose variables use `num_slots` frame slots.
+  static void Emit(const ASTNode & root, size_t num_slots, std::ostream & os) {
+    CppEmitter emitter;
+    for (const ASTNode & child : root.GetChildren()) emitter.Statement(child);
+
+    os << PRELUDE << "int main() {\n";
+    for (size_t i = 0; i < num_slots; ++i) os << "  double s" << i << " = 0.0;\n";
+    for (size_t i = 0; i < emitter.num_temps; ++i) os << "  double t" << i << ";\n";
+    os << emitter.body << "  mc_flush();\n  return 0;\n}\n";
+  }
+};
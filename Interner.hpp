@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Maps each distinct identifier spelling to a small dense ID.
+ * Names are views into the source text, which must outlive the interner.  Each spelling is
+ * hashed once, when the lexer first sees it; everything after that compares integers.
+ */
+class Interner
+{
+private:
+  std::unordered_map<std::string_view, uint32_t> ids{};
+  std::vector<std::string_view> names{};   // Spelling for each ID
+
+public:
+  static constexpr uint32_t NO_NAME = static_cast<uint32_t>(-1);
+
+  size_t size() const { return names.size(); }
+
+  // Return the ID for a name, assigning the next free one if it is new.
+  uint32_t Intern(std::string_view name) {
+    auto [it, added] = ids.try_emplace(name, static_cast<uint32_t>(names.size()));
+    if (added) names.push_back(name);
+    return it->second;
+  }
+
+  // Return the ID for a name, or NO_NAME if it has never been interned.
+  uint32_t Find(std::string_view name) const {
+    auto it = ids.find(name);
+    return it == ids.end() ? NO_NAME : it->second;
+  }
+
+  std::string_view GetName(uint32_t id) const { return names[id]; }
+};
@@ -0,0 +1,749 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <set>
+#include <vector>
+#include <assert.h>
+
+#include "ASTNode.hpp"
+#include "Bytecode.hpp"
+#include "ClosureCompiler.hpp"
+#include "CppEmitter.hpp"
+#include "Interner.hpp"
+#include "lexer.hpp"
+#include "Optimizer.hpp"
+#include "PrintTemplate.hpp"
+#include "Profiler.hpp"
+#include "RunStats.hpp"
+#include "SourceBuffer.hpp"
+#include "SymbolTable.hpp"
+#include "ValueNumbering.hpp"
+
+// Using
+using std::string;
+using std::endl;
+
+
+/**
+ * One parsed script: lexes and parses at construction, then runs on any of the engines.
+ * Nothing here touches process state; output goes to the given sink and errors are thrown
+ * as MacroCalcError.
+ */
+class MacroCalc {
+  private:
+    SourceBuffer source{};                    // Kept alive so tokens can view into it
+    std::vector<emplex::TokenView> tokens{};
+    size_t token_id{0};
+    ASTNode root{ASTNode::SCOPE};
+
+    Interner names{};                         // Identifier spellings, interned by the lexer
+    SymbolTable symbols{};
+    std::vector<double> frame{};              // Variable values for the tree walker, by slot
+    OutputSink & out;                         // Where PRINT output goes
+    Profiler * profiler{nullptr};             // Used by the profiled tree walker
+    RunStats stats{};                         // Front-end phase times, for --stats
+
+    std::string TokenName(int id) const {
+      if (id > 0 && id < 128) {
+        return std::string("'") + static_cast<char>(id) + "'";
+      }
+      return emplex::Lexer::TokenName(id);
+    }
+
+    // The token list always ends with an EOF token, which is never consumed.
+    const emplex::TokenView & CurToken() const { return tokens[token_id]; }
+
+    const emplex::TokenView & UseToken() {
+      const emplex::TokenView & token = tokens[token_id];
+      if (token_id + 1 < tokens.size()) ++token_id;
+      return token;
+    }
+
+    const emplex::TokenView & UseToken(int required_id, std::string err_message="") {
+      if (CurToken() != required_id) {
+        if (err_message.size()) Error(CurToken(), err_message);
+        else {
+          Error(CurToken(),
+            "Expected token type ", TokenName(required_id),
+            ", but found ", TokenName(CurToken())
+          );
+        }
+      }
+      return UseToken();
+    }
+
+    bool UseTokenIf(int test_id) {
+      if (CurToken() == test_id) {
+        token_id++;
+        return true;
+      }
+      return false;
+    }
+
+    ASTNode MakeVarNode(const emplex::TokenView & token) {
+      size_t slot = symbols.GetSlot(symbols.GetVarID(token.name_id));
+      assert(slot < symbols.GetFrameSize());
+      ASTNode out(ASTNode::VARIABLE);
+      out.SetVarID(slot);
+      out.SetLine(token.line_id);
+      return out;
+    }
+
+  public:
+    // Parse a script; PRINT output will go to `out`.  Errors throw MacroCalcError.
+    MacroCalc(std::string filename, OutputSink & out = OutputSink::Stdout()) : out(out) {
+      const auto start = RunStats::clock::now();
+      if (!source.Load(filename)) {
+        RuntimeError("Unable to open file '" + filename + "'.");
+      }
+      stats.read_ms = RunStats::MsSince(start);
+      Load();
+    }
+
+    // Parse a script held in memory.
+    MacroCalc(SourceBuffer text, OutputSink & out) : source(std::move(text)), out(out) {
+      Load();
+    }
+
+    // Tokenize `source` and parse it into `root`.
+    void Load() {
+      auto start = RunStats::clock::now();
+      emplex::Lexer lexer;
+      tokens = lexer.TokenizeViews(source.View(), &names);
+      symbols.Reserve(names.size());
+      const size_t last_line = tokens.size() ? tokens.back().line_id : 1;
+      tokens.push_back({emplex::Lexer::ID__EOF_, source.View().substr(source.View().size()), last_line});
+      stats.lex_ms = RunStats::MsSince(start);
+
+      start = RunStats::clock::now();
+      Parse();
+      stats.parse_ms = RunStats::MsSince(start);
+    }
+
+    void Parse() {
+      while (CurToken() != emplex::Lexer::ID__EOF_) {
+        ASTNode cur_node = ParseStatement();
+        if (cur_node.GetType()) root.AddChild(std::move(cur_node));
+      }
+    }
+
+    // A compound statement (a scope, or an if or while waiting for its body) on the parse stack.
+    struct OpenStatement {
+      enum Kind { SCOPE, IF_THEN, IF_ELSE, WHILE_BODY, COMPLETE } kind;
+      ASTNode node;
+      size_t line;   // Line to give the node once complete, or 0 for none
+    };
+    std::vector<OpenStatement> open_statements{};   // ParseStatement's stack, reused between calls
+
+    // Is the compound statement on top of the stack complete?  Uses up the '}' or 'else' that
+    // decides it.
+    bool CloseStatement(OpenStatement & top) {
+      using L = emplex::Lexer;
+      const size_t num_children = top.node.GetChildren().size();
+      switch (top.kind) {
+      case OpenStatement::SCOPE:
+        if (CurToken() != L::ID_ENDSCOPE) return false;
+        symbols.PopScope();
+        UseToken();
+        return true;
+      case OpenStatement::IF_THEN:
+        if (num_children < 2) return false;
+        if (UseTokenIf(L::ID_ELSE)) {
+          top.kind = OpenStatement::IF_ELSE;
+          return false;
+        }
+        return true;
+      case OpenStatement::IF_ELSE:
+        return num_children == 3;
+      case OpenStatement::WHILE_BODY:
+        return num_children == 2;
+      case OpenStatement::COMPLETE:
+        return true;
+      }
+      return true;
+    }
+
+    // Parse one statement.  A statement's line is the line of its first token, except for a
+    // scope that is directly the body of an if or while.  Scopes and bodies nest on an explicit
+    // stack instead of through recursion, so nesting depth is limited only by memory.
+    ASTNode ParseStatement() {
+      using L = emplex::Lexer;
+      std::vector<OpenStatement> & open = open_statements;
+      open.clear();   // Left over if the last statement had an error
+      while (true) {
+        const size_t line = CurToken().line_id;
+        switch (CurToken()) {
+        case L::ID_BEGINSCOPE: {
+          const bool is_body = open.size() && open.back().kind != OpenStatement::SCOPE;
+          UseToken();
+          symbols.PushScope();
+          open.emplace_back(OpenStatement::SCOPE, ASTNode::SCOPE, is_body ? 0 : line);
+          break;
+        }
+        case L::ID_IF:
+          open.emplace_back(OpenStatement::IF_THEN, ParseIfHeader(), line);
+          break;
+        case L::ID_WHILE:
+          open.emplace_back(OpenStatement::WHILE_BODY, ParseWhileHeader(), line);
+          // A while loop needs no body; one ending in ';' is already complete.
+          if (UseTokenIf(L::ID_SEMICOLON)) open.back().kind = OpenStatement::COMPLETE;
+          break;
+        default: {
+          ASTNode statement = ParseSimpleStatement();
+          statement.SetLine(line);
+          if (open.empty()) return statement;
+          if (statement.GetType() != ASTNode::EMPTY) open.back().node.AddChild(std::move(statement));
+          // A lone ';' adds nothing to a scope, but as an if or else body it is an empty scope.
+          else if (open.back().kind != OpenStatement::SCOPE) open.back().node.AddChild(ASTNode{ASTNode::SCOPE});
+        }
+        }
+
+        // Hand each completed construct to the one enclosing it.
+        while (CloseStatement(open.back())) {
+          OpenStatement & top = open.back();
+          if (top.line) top.node.SetLine(top.line);
+          if (open.size() == 1) return std::move(top.node);
+          open[open.size() - 2].node.AddChild(std::move(top.node));
+          open.pop_back();
+        }
+      }
+    }
+
+    // Statements that contain no other statements.
+    ASTNode ParseSimpleStatement() {
+      switch (CurToken()) {
+      using namespace emplex;
+      case Lexer::ID_VAR : return ParseDeclare();
+      case Lexer::ID_IDENTIFIER : return ParseAssign();
+      case Lexer::ID_PRINT : return ParsePrint();
+      case Lexer::ID_SEMICOLON:
+        UseToken();
+        return ASTNode{};
+      default: {
+        ASTNode expression = ParseExpression();
+        UseToken(Lexer::ID_SEMICOLON);
+        return expression;
+      }
+      }
+    }
+
+  ASTNode ParsePrint() {
+    UseToken(emplex::Lexer::ID_PRINT);
+    UseToken(emplex::Lexer::ID_OPENPAREN);
+
+    ASTNode print_node{ASTNode::PRINT};
+
+    /**If the print argument is a string literal we split it into text and {variable} segments
+     * and add either string children or variable children to the print node
+    **/
+    if (CurToken() == emplex::Lexer::ID_STRINGLITERAL) {
+      const emplex::TokenView & token = UseToken();
+      const std::string_view body = token.lexeme.substr(1, token.lexeme.size() - 2);
+
+      for (const PrintSegment & segment : CompilePrintTemplate(body, token.line_id)) {
+        if (segment.kind == PrintSegment::TEXT) {
+          ASTNode string_node{ASTNode::STRING, std::string(segment.text)};
+          string_node.SetLine(token.line_id);
+          print_node.AddChild(std::move(string_node));
+          continue;
+        }
+        const uint32_t name_id = names.Find(segment.text);
+        if (!symbols.HasVar(name_id)) {
+          Error(token, "Undeclared variable '", segment.text, "' used in print string.");
+        }
+        ASTNode var_node{ASTNode::VARIABLE, symbols.GetSlot(symbols.GetVarID(name_id))};
+        var_node.SetLine(token.line_id);
+        print_node.AddChild(std::move(var_node));
+      }
+    }
+    //If it's not as string literal it's assumed to be an expression and appended as a child
+    else {
+      print_node.AddChild(ParseExpression());
+    }
+
+    UseToken(emplex::Lexer::ID_CLOSEPAREN);
+    UseToken(emplex::Lexer::ID_SEMICOLON);
+
+    return print_node;
+  }
+
+  //Handles variable declarations ex: var x = 10;
+  ASTNode ParseDeclare() {
+    UseToken(emplex::Lexer::ID_VAR);
+    auto id_token = UseToken(emplex::Lexer::ID_IDENTIFIER);
+    symbols.AddVar(id_token.name_id, id_token.lexeme, id_token.line_id);
+
+    auto lhs_node = MakeVarNode(id_token);
+
+    // Slots are shared between sibling scopes, so a bare declaration must still reset its slot.
+    if (UseTokenIf(emplex::Lexer::ID_SEMICOLON)) {
+      return ASTNode{ASTNode::ASSIGN, std::move(lhs_node), ASTNode{ASTNode::NUMBER, 0.0}};
+    }
+
+    UseToken(emplex::Lexer::ID_ASSIGN, "Expected ';' or '='.");
+
+    auto rhs_node = ParseExpression();
+    UseToken(emplex::Lexer::ID_SEMICOLON);
+
+    return ASTNode{ASTNode::ASSIGN, std::move(lhs_node), std::move(rhs_node)};
+
+  }
+
+  //Handles variable reassignment ex: x = 10;
+  ASTNode ParseAssign() {
+    auto id_token = UseToken(emplex::Lexer::ID_IDENTIFIER);
+
+    UseToken(emplex::Lexer::ID_ASSIGN, "Expected '='.");
+
+    auto lhs_node = MakeVarNode(id_token);
+    auto rhs_node = ParseExpression();
+    UseToken(emplex::Lexer::ID_SEMICOLON);
+
+    return ASTNode{ASTNode::ASSIGN, std::move(lhs_node), std::move(rhs_node)};
+  }
+
+  // The part of an if statement before its body; ParseStatement adds the body and any else.
+  ASTNode ParseIfHeader() {
+    ASTNode if_node{ASTNode::IF};
+
+    UseToken(emplex::Lexer::ID_IF);
+    UseToken(emplex::Lexer::ID_OPENPAREN);
+
+    //Parse the expression within the parenthesis
+    if_node.AddChild(ParseExpression());
+    UseToken(emplex::Lexer::ID_CLOSEPAREN);
+
+    return if_node;
+  }
+
+  // The part of a while loop before its body, which is optional.
+  ASTNode ParseWhileHeader() {
+    UseToken(emplex::Lexer::ID_WHILE);
+    UseToken(emplex::Lexer::ID_OPENPAREN);
+
+    ASTNode while_node{ASTNode::WHILE};
+
+    while_node.AddChild(ParseExpression());
+
+    UseToken(emplex::Lexer::ID_CLOSEPAREN);
+
+    return while_node;
+  }
+
+  // Binding information for a binary operator token.
+  struct BinaryOp {
+    int precedence{0};           // 0 means "not a binary operator"
+    bool right_assoc{false};
+    bool non_assoc{false};       // Chaining (a < b < c) is an error
+    ASTNode::Type type{ASTNode::EMPTY};
+    const char * lexeme{""};
+  };
+
+  // Precedence table indexed by token ID; built once.
+  static const BinaryOp & GetBinaryOp(int token_id) {
+    using L = emplex::Lexer;
+    static const auto table = [](){
+      std::array<BinaryOp, L::MAX_ID + 1> ops{};
+      ops[L::ID_ASSIGN]        = {1, true,  false, ASTNode::ASSIGN,     "="};
+      ops[L::ID_OR]            = {2, false, false, ASTNode::LOGICAL_OP, "||"};
+      ops[L::ID_AND]           = {3, false, false, ASTNode::LOGICAL_OP, "&&"};
+      ops[L::ID_EQUAL]         = {4, false, true,  ASTNode::COMP_OP,    "=="};
+      ops[L::ID_NOT_EQUAL]     = {4, false, true,  ASTNode::COMP_OP,    "!="};
+      ops[L::ID_LESS]          = {5, false, true,  ASTNode::COMP_OP,    "<"};
+      ops[L::ID_LESS_EQUAL]    = {5, false, true,  ASTNode::COMP_OP,    "<="};
+      ops[L::ID_GREATER]       = {5, false, true,  ASTNode::COMP_OP,    ">"};
+      ops[L::ID_GREATER_EQUAL] = {5, false, true,  ASTNode::COMP_OP,    ">="};
+      ops[L::ID_PLUS]          = {6, false, false, ASTNode::MATH_OP,    "+"};
+      ops[L::ID_MINUS]         = {6, false, false, ASTNode::MATH_OP,    "-"};
+      ops[L::ID_TIMES]         = {7, false, false, ASTNode::MATH_OP,    "*"};
+      ops[L::ID_DIVIDE]        = {7, false, false, ASTNode::MATH_OP,    "/"};
+      ops[L::ID_MODULUS]       = {7, false, false, ASTNode::MATH_OP,    "%"};
+      ops[L::ID_POWER]         = {8, true,  false, ASTNode::MATH_OP,    "**"};
+      return ops;
+    }();
+    static const BinaryOp none{};
+    return (token_id >= 0 && token_id <= L::MAX_ID) ? table[static_cast<size_t>(token_id)] : none;
+  }
+
+  // An operator or open parenthesis in ParseExpression, still waiting for its operands.
+  struct PendingOp {
+    enum Kind { PAREN, MODIFIER, BINARY } kind;
+    emplex::TokenView token;
+    const BinaryOp * binary{nullptr};
+  };
+
+  // ParseExpression's stacks.  It never re-enters itself, so they are kept between calls to
+  // reuse their memory.
+  std::vector<ASTNode> expr_operands{};
+  std::vector<PendingOp> expr_ops{};
+
+  // Combine the innermost pending binary operator with its lhs, the last operand on the
+  // stack, and `rhs`, leaving the result in `rhs`.
+  static void ReduceBinary(std::vector<PendingOp> & ops, std::vector<ASTNode> & operands, ASTNode & rhs) {
+    const PendingOp pending = ops.back();
+    ops.pop_back();
+    rhs = ASTNode{pending.binary->type, std::move(operands.back()), std::move(rhs)};
+    operands.pop_back();
+    rhs.SetOp(pending.token.id);
+    rhs.SetStrValue(pending.binary->lexeme);
+    rhs.SetLine(pending.token.line_id);
+  }
+
+  // Operator precedence parsing with explicit operand and operator stacks (shunting-yard), so
+  // deeply nested parentheses and long unary chains need no recursion.  Unary operators bind
+  // tighter than any binary operator; a non-associative operator may not be chained with
+  // another of the same precedence.  The operand being built is kept in `value` and only
+  // goes on the stack when a binary operator follows it.
+  ASTNode ParseExpression() {
+    using L = emplex::Lexer;
+    std::vector<ASTNode> & operands = expr_operands;
+    std::vector<PendingOp> & ops = expr_ops;
+    operands.clear();   // Left over if the last expression had an error
+    ops.clear();
+    while (true) {
+      // Open parentheses and unary operators wait on the stack for the operand that follows.
+      const emplex::TokenView & token = UseToken();
+      if (token.id == L::ID_OPENPAREN || token.id == L::ID_NOT || token.id == L::ID_MINUS) {
+        ops.push_back({token.id == L::ID_OPENPAREN ? PendingOp::PAREN : PendingOp::MODIFIER, token});
+        continue;
+      }
+      ASTNode value = ParseOperand(token);
+
+      // Apply the unary operators just before the operand and close any parentheses that end
+      // here, until a binary operator or the end of the expression.
+      while (true) {
+        while (ops.size() && ops.back().kind == PendingOp::MODIFIER) {
+          const emplex::TokenView & modifier = ops.back().token;
+          value = ASTNode{ASTNode::MODIFIER, std::move(value)};
+          value.SetOp(modifier.id);
+          value.SetStrValue(std::string(modifier.lexeme));
+          value.SetLine(modifier.line_id);
+          ops.pop_back();
+        }
+        if (GetBinaryOp(CurToken()).precedence > 0) break;
+        while (ops.size() && ops.back().kind == PendingOp::BINARY) ReduceBinary(ops, operands, value);
+        if (ops.empty()) return value;
+        const size_t line = ops.back().token.line_id;
+        ops.pop_back();
+        UseToken(L::ID_CLOSEPAREN);
+        value = ASTNode{ASTNode::PARENTH, std::move(value)};
+        value.SetStrValue("()");
+        value.SetLine(line);
+      }
+
+      // Operators on the stack that bind at least as tightly take the operand first.
+      const BinaryOp & op = GetBinaryOp(CurToken());
+      while (ops.size() && ops.back().kind == PendingOp::BINARY) {
+        const BinaryOp & prev = *ops.back().binary;
+        if (prev.precedence < op.precedence || (prev.precedence == op.precedence && op.right_assoc)) break;
+        if (prev.non_assoc && prev.precedence == op.precedence) {
+          if (op.precedence == GetBinaryOp(L::ID_EQUAL).precedence) {
+            Error(CurToken(), "Chaining of equality operators is not allowed.");
+          }
+          Error(CurToken(), "Chaining of non-associative comparison operators is not allowed.");
+        }
+        ReduceBinary(ops, operands, value);
+      }
+      const emplex::TokenView & op_token = UseToken();
+      if (op.type == ASTNode::ASSIGN && value.GetType() != ASTNode::VARIABLE) {
+        Error(op_token, "The left side of an assignment must be a variable.");
+      }
+      operands.push_back(std::move(value));
+      ops.push_back({PendingOp::BINARY, op_token, &op});
+    }
+  }
+
+  // Parse a literal or variable whose token has just been used.
+  ASTNode ParseOperand(const emplex::TokenView & token) {
+    using L = emplex::Lexer;
+    switch (token.id) {
+    case L::ID_IDENTIFIER: {
+      if (!symbols.HasVar(token.name_id)) {
+        Error(token, "Undeclared variable '", token.lexeme, "' used in expression.");
+      }
+      ASTNode node{ASTNode::VARIABLE, symbols.GetSlot(symbols.GetVarID(token.name_id))};
+      node.SetStrValue(std::string(token.lexeme));
+      node.SetLine(token.line_id);
+      return node;
+    }
+    case L::ID_INT:
+    case L::ID_FLOAT: {
+      // Parse the lexeme as a double straight from the source text
+      double value = 0.0;
+      std::from_chars(token.lexeme.data(), token.lexeme.data() + token.lexeme.size(), value);
+      ASTNode node{ASTNode::NUMBER, value};
+      node.SetLine(token.line_id);
+      return node;
+    }
+    default:
+      Error(token, "Expected a variable or number but found '", token.lexeme, "'.");
+    }
+  }
+
+  // Evaluate one node on the tree walker.  The profiled walker is a separate instantiation,
+  // so the normal one pays nothing for it.
+  template <bool PROFILED = false>
+  double Run(const ASTNode& node) {
+    if constexpr (PROFILED) {
+      return profiler->Measure(node, [this, &node]() { return RunNode<true>(node); });
+    }
+    return RunNode<PROFILED>(node);
+  }
+
+  template <bool PROFILED>
+  double RunNode(const ASTNode& node) {
+    switch (node.GetType()) {
+      case ASTNode::SCOPE: {
+        for (auto & child : node.GetChildren()) {
+          Run<PROFILED>(child);
+        }
+        return 0.0;
+      }
+
+      // Return numeric values directly
+      case ASTNode::NUMBER: {
+        return node.GetValue();
+      }
+
+      case ASTNode::PARENTH: {
+        return Run<PROFILED>(node.GetChild(0));
+      }
+
+      // Retrieve and return the value of a var from its frame slot
+      case ASTNode::VARIABLE: {
+        return frame[node.GetVarID()];
+      }
+
+      // Assign the result of an EXPR to a variable
+      case ASTNode::ASSIGN: {
+        double rhs_value = Run<PROFILED>(node.GetChild(1)); // Get RHS
+        const ASTNode& lhs = node.GetChild(0);
+        frame[lhs.GetVarID()] = rhs_value;
+        return rhs_value;
+      }
+
+      // Handle both Strings and expressions in print (EG) 
+      // I need to test this to see if it makes sense.
+      case ASTNode::PRINT: {
+        // Loop through all the children of the node.
+        // A PRINT node can have multiple children, representing either strings or expressions.
+        for (const auto &child : node.GetChildren()) {
+            
+           if (child.GetType() == ASTNode::STRING) {
+            out.Write(child.GetStrValue());
+           } 
+           else if (child.GetType() == ASTNode::VARIABLE) {
+            out.WriteNumber(frame[child.GetVarID()]);
+           }
+           else {
+            out.WriteNumber(Run<PROFILED>(child));
+           }
+         }
+    
+        // After printing all children, newline
+        out.Write('\n');
+        return 0.0;
+      }
+
+      case ASTNode::IF: {
+        if (Run<PROFILED>(node.GetChild(0)) != 0.0) {
+          return Run<PROFILED>(node.GetChild(1)); // Run "IF" branch
+        } else if (node.GetChildren().size() > 2) {
+          return Run<PROFILED>(node.GetChild(2)); // Run "Else" branch
+        }
+        return 0.0;
+      }
+
+      // Run while loop with repeated checks on condition
+      case ASTNode::WHILE: {
+        while (Run<PROFILED>(node.GetChild(0)) != 0.0) { // Check condition 
+          if (node.GetChildren().size() > 1) Run<PROFILED>(node.GetChild(1)); // Execute body, if any
+        }
+        return 0.0;
+      }
+
+      case ASTNode::LOGICAL_OP: {
+        // Only grab lhs incase we short-circuit
+        const double lhs = Run<PROFILED>(node.GetChild(0));
+        
+        if (node.GetStrValue() == "&&") {
+          if (lhs == 0.0) return 0.0;  // Short-circuit if lhs is false
+          return Run<PROFILED>(node.GetChild(1)) != 0.0 ? 1.0 : 0.0;
+        } else if (node.GetStrValue() == "||") {
+          if (lhs != 0.0) return 1.0;  // Short-circuit if lhs is true
+          return Run<PROFILED>(node.GetChild(1)) != 0.0 ? 1.0 : 0.0;
+        }
+
+        Error(0, "Unknown logical operator '", node.GetStrValue(), "'.");
+        return 0.0;
+      }
+
+
+      case ASTNode::MATH_OP: {
+        // Evaluate left and right sub-expressions first (recursion)
+        double lhs_value = Run<PROFILED>(node.GetChild(0));
+        double rhs_value = Run<PROFILED>(node.GetChild(1));
+        // Get the OP
+        const std::string &op = node.GetStrValue();
+        // Perform the operation based on the operator string
+          if (op == "+") return lhs_value + rhs_value;
+          else if (op == "-") return lhs_value - rhs_value;
+          else if (op == "*") return lhs_value * rhs_value;
+          else if (op == "/") {
+            if (rhs_value == 0) RuntimeError("Division by zero.");
+            return lhs_value / rhs_value;
+          }
+          else if (op == "%") {
+            if (rhs_value == 0) RuntimeError("Modulus by zero.");
+            return std::fmod(lhs_value, rhs_value);
+          }
+          else if (op == "**") return std::pow(lhs_value, rhs_value);
+          else RuntimeError("Unknown operator '" + op + "'.");
+        }
+
+      case ASTNode::COMP_OP: {
+        // Evaluate left and right sub-expressions first (recursion)
+        double lhs_value = Run<PROFILED>(node.GetChild(0));
+        double rhs_value = Run<PROFILED>(node.GetChild(1));
+        // Get the op
+        const std::string &op = node.GetStrValue();
+        // Run T/F based on lhs and rhs, return 1.0 (T) or 0.0 (F)
+        if (op == "<") return lhs_value < rhs_value ? 1.0 : 0.0;
+        else if (op == "<=") return lhs_value <= rhs_value ? 1.0 : 0.0;
+        else if (op == ">") return lhs_value > rhs_value ? 1.0 : 0.0;
+        else if (op == ">=") return lhs_value >= rhs_value ? 1.0 : 0.0;
+        else if (op == "==") return lhs_value == rhs_value ? 1.0 : 0.0;
+        else if (op == "!=") return lhs_value != rhs_value ? 1.0 : 0.0;
+        else RuntimeError("Unknown operator '" + op + "'.");
+      }
+
+      case ASTNode::MODIFIER: {
+        double child_val = Run<PROFILED>(node.GetChild(0));
+
+        const std::string &op = node.GetStrValue();
+
+        if (op == "-") return child_val * -1;
+        else if (op == "!") return child_val == 0.0 ? 1.0 : 0.0;
+        else RuntimeError("Unknown modifier '" + op + "'.");
+      }
+
+      // Shouldn't have any EMPTY
+      case ASTNode::EMPTY:
+        std::cerr << "ERROR: Detected EMPTY node" << std::endl;
+        return 0.0;
+
+      default:
+        return 0.0;
+      }
+  }
+
+  void Run() {
+    frame.assign(symbols.GetFrameSize(), 0.0);
+    Run(root);
+  }
+
+  // Run on the tree walker while `profiler` records the count and time of every node.
+  void RunProfiled(Profiler & profiler) {
+    this->profiler = &profiler;
+    frame.assign(symbols.GetFrameSize(), 0.0);
+    try {
+      Run<true>(root);
+    } catch (...) {
+      this->profiler = nullptr;
+      throw;
+    }
+    this->profiler = nullptr;
+  }
+
+  // Phase times so far, plus the current size of the tokens, tree and symbol table.
+  // Call before RunVM, which releases the tree.
+  RunStats GetStats() const {
+    RunStats result = stats;
+    result.source_bytes = source.View().size();
+    result.num_tokens = tokens.size();
+    result.token_bytes = tokens.capacity() * sizeof(emplex::TokenView);
+    result.ast_nodes = ASTArena::CountNodes(root);
+    result.ast_bytes = ASTArena::TreeBytes(root);
+    result.num_scopes = symbols.GetNumScopes();
+    result.num_vars = symbols.GetNumVars();
+    result.frame_slots = symbols.GetFrameSize();
+    return result;
+  }
+
+  const ASTNode & GetRoot() const { return root; }
+  std::string_view GetSource() const { return source.View(); }
+
+  // Fold constants and simplify the tree, then reuse repeated values and drop dead stores
+  // (see ValueNumbering), before it is run.
+  void Optimize() {
+    Optimizer optimizer;
+    optimizer.Optimize(root);
+    ValueNumbering numbering(symbols.GetFrameSize());
+    numbering.Run(root);
+    symbols.ReserveSlots(numbering.GetFrameSize());
+    // Propagated literals can leave more to fold, e.g. literal print arguments.
+    if (numbering.GetStats().constants) optimizer.Optimize(root);
+  }
+
+  // Flatten the tree into an arena, lower it to bytecode, and execute it on the register VM.
+  // With `jit`, numeric while loops run as native code.  With `counts`, also record how many
+  // times each kind of fused instruction ran, even if the program stops with an error.
+  void RunVM(bool jit = false, RunStats * counts = nullptr) {
+    Bytecode bytecode = CompileBytecode(jit);
+    VM vm;
+    if (!counts) {
+      vm.Run(bytecode, out);
+      return;
+    }
+    auto record = [&]() {
+      counts->fused.clear();
+      for (size_t i = Bytecode::NOT_FUSED + 1; i < Bytecode::NUM_FUSIONS; ++i) {
+        const auto fusion = static_cast<Bytecode::Fusion>(i);
+        counts->fused.emplace_back(Bytecode::FusionName(fusion), vm.GetFired(fusion));
+      }
+    };
+    try {
+      vm.Run<true>(bytecode, out);
+    } catch (const MacroCalcError &) {
+      record();
+      throw;
+    }
+    record();
+  }
+
+  // Lower the program to bytecode, which can then be run any number of times.
+  // The pointer tree is released, so only the VM can run this MacroCalc afterwards.
+  Bytecode CompileBytecode(bool jit = false) {
+    ASTArena arena(root);
+    root = ASTNode{ASTNode::SCOPE};
+    return BytecodeCompiler::Compile(arena, symbols.GetFrameSize(), jit);
+  }
+
+  // Compile the tree into pre-bound closures once, then run them.
+  void RunClosures() {
+    ClosureProgram program(root, symbols.GetFrameSize());
+    program.Run(out);
+  }
+
+  // Write the program as a standalone C++ translation unit instead of running it.
+  void EmitCpp(std::ostream & os) const {
+    CppEmitter::Emit(root, symbols.GetFrameSize(), os);
+  }
+
+  // Compare the memory footprint of the pointer tree with its flattened arena.
+  void PrintASTStats(std::ostream & os) const {
+    ASTArena arena(root);
+    os << "AST nodes: " << arena.size() << "\n"
+       << "Tree bytes: " << ASTArena::TreeBytes(root)
+       << " (" << sizeof(ASTNode) << " bytes/node + child vectors + strings)\n"
+       << "Arena bytes: " << arena.Bytes()
+       << " (" << sizeof(ASTArena::Node) << " bytes/node + string table)" << std::endl;
+  }
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Every error a script can cause, at parse time or at run time.
+ * Errors are thrown rather than ending the process, so a caller running many scripts can
+ * contain each failure; what() is exactly the line the command-line tool prints.
+ */
+class MacroCalcError : public std::runtime_error
+{
+private:
+  size_t line_num;   // Source line for parse errors; 0 for runtime errors
+  std::string message;
+
+  static std::string Format(size_t line_num, const std::string & message) {
+    if (line_num == 0) return "ERROR: " + message;
+    return "ERROR (Line " + std::to_string(line_num) + "): " + message;
+  }
+
+public:
+  MacroCalcError(size_t line_num, const std::string & message)
+    : std::runtime_error(Format(line_num, message)), line_num(line_num), message(message) { }
+
+  size_t GetLine() const { return line_num; }
+  const std::string & GetMessage() const { return message; }   // Without the "ERROR" prefix
+  bool IsRuntimeError() const { return line_num == 0; }
+};
+
+// Raise an error found while running a script, e.g. RuntimeError("Division by zero.").
+[[noreturn]] inline void RuntimeError(const std::string & message)
+{
+  throw MacroCalcError(0, message);
+}
@@ -0,0 +1,448 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "ASTArena.hpp"
+#include "lexer.hpp"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define MACROCALC_HAS_JIT 1
+#endif
+
+/**
+ * Executable machine code produced by JitCompiler.
+ * The code is copied into its own mapping, which is made executable (and no longer writable)
+ * once filled.  Each compiled loop is a function `int loop(double * slots)` at some offset; it
+ * returns a Status so the caller can report runtime errors the same way the interpreter does.
+ */
+class NativeCode
+{
+private:
+  uint8_t * code{nullptr};
+  size_t size{0};
+
+public:
+  enum Status { OK = 0, DIVISION_BY_ZERO = 1, MODULUS_BY_ZERO = 2 };
+  using Function = int (*)(double * slots);
+
+  explicit NativeCode(const std::vector<uint8_t> & bytes) {
+#ifdef MACROCALC_HAS_JIT
+    if (bytes.empty()) return;
+    void * addr = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) return;
+    std::memcpy(addr, bytes.data(), bytes.size());
+    if (mprotect(addr, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+      munmap(addr, bytes.size());
+      return;
+    }
+    code = static_cast<uint8_t *>(addr);
+    size = bytes.size();
+#endif
+  }
+  NativeCode(const NativeCode &) = delete;
+  NativeCode & operator=(const NativeCode &) = delete;
+  ~NativeCode() {
+#ifdef MACROCALC_HAS_JIT
+    if (code) munmap(code, size);
+#endif
+  }
+
+  // False if the platform has no JIT or the executable mapping could not be created.
+  bool IsValid() const { return code != nullptr; }
+
+  int Call(size_t entry, double * slots) const {
+    return reinterpret_cast<Function>(code + entry)(slots);
+  }
+};
+
+
+/**
+ * Compiles WHILE loops from a flattened AST straight into x86-64 machine code.
+ * Only loops made entirely of numeric work are accepted: arithmetic, comparisons, logical and
+ * unary operators, assignments, and nested scopes, ifs and whiles.  Anything else (PRINT in
+ * particular) makes CompileLoop() fail and the loop stays in the interpreter.
+ *
+ * Generated code keeps variables in the slot array (rbx holds its base) and evaluates
+ * expressions in xmm0-xmm14, one register per depth of the expression tree; xmm15 is scratch.
+ * `%` and `**` call the same fmod/pow the interpreters use, spilling live registers first.
+ * Division and modulus by zero leave the function with an error Status.
+ */
+class JitCompiler
+{
+private:
+  using node_t = uint32_t;
+  using L = emplex::Lexer;
+
+  const ASTArena & ast;
+  std::vector<uint8_t> buf{};
+  size_t num_loops{0};
+
+  // Labels and rel32 fixups for the function being compiled.
+  static constexpr size_t UNBOUND = static_cast<size_t>(-1);
+  std::vector<size_t> labels{};
+  struct Fixup { size_t at; uint32_t label; };
+  std::vector<Fixup> fixups{};
+  uint32_t div_error{0};
+  uint32_t mod_error{0};
+
+  static constexpr int MAX_REG = 14;        // Highest xmm register used for values
+  static constexpr int SCRATCH = 15;
+  static constexpr int RBX = 3;
+  static constexpr int RSP = 4;
+  static constexpr int32_t SPILL_BYTES = 128;   // Keeps rsp 16-byte aligned for calls
+
+  // Condition codes for Jcc (low nibble of 0x0F 0x8?).
+  enum Cond : uint8_t { JB = 0x2, JAE = 0x3, JE = 0x4, JNE = 0x5, JBE = 0x6, JA = 0x7, JP = 0xA };
+
+  // -- Encoding --
+
+  void Byte(uint8_t b) { buf.push_back(b); }
+  void U32(uint32_t v) { for (int i = 0; i < 4; ++i) Byte(static_cast<uint8_t>(v >> (8 * i))); }
+  void U64(uint64_t v) { for (int i = 0; i < 8; ++i) Byte(static_cast<uint8_t>(v >> (8 * i))); }
+
+  // SSE instruction on two xmm registers: prefix [REX] 0F op ModRM(reg, rm).
+  void SseRR(uint8_t prefix, uint8_t op, int reg, int rm) {
+    Byte(prefix);
+    const uint8_t rex = 0x40 | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+    if (rex != 0x40) Byte(rex);
+    Byte(0x0F);
+    Byte(op);
+    Byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+  }
+
+  // SSE instruction with a [base + disp32] memory operand (base is rbx or rsp).
+  void SseRM(uint8_t prefix, uint8_t op, int reg, int base, int32_t disp) {
+    Byte(prefix);
+    if (reg & 8) Byte(0x44);
+    Byte(0x0F);
+    Byte(op);
+    Byte(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | base));
+    if (base == RSP) Byte(0x24);   // SIB: no index
+    U32(static_cast<uint32_t>(disp));
+  }
+
+  void LoadSlot(int reg, uint32_t slot) { SseRM(0xF2, 0x10, reg, RBX, static_cast<int32_t>(slot * 8)); }
+  void StoreSlot(int reg, uint32_t slot) { SseRM(0xF2, 0x11, reg, RBX, static_cast<int32_t>(slot * 8)); }
+  void MoveReg(int dest, int src) { if (dest != src) SseRR(0x66, 0x28, dest, src); }   // movapd
+  void Zero(int reg) { SseRR(0x66, 0x57, reg, reg); }                                  // xorpd
+
+  void LoadConst(int reg, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if (bits == 0) { Zero(reg); return; }
+    Byte(0x48); Byte(0xB8); U64(bits);                   // mov rax, imm64
+    Byte(0x66); Byte(static_cast<uint8_t>(0x48 | ((reg & 8) ? 4 : 0)));
+    Byte(0x0F); Byte(0x6E); Byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3)));   // movq xmm, rax
+  }
+
+  // Set ZF if xmm `reg` holds +0 or -0 (NaN is nonzero, as in the interpreters).
+  void TestZero(int reg) {
+    Byte(0x66); Byte(static_cast<uint8_t>(0x48 | ((reg & 8) ? 4 : 0)));
+    Byte(0x0F); Byte(0x7E); Byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3)));   // movq rax, xmm
+    Byte(0x48); Byte(0x01); Byte(0xC0);                                             // add rax, rax
+  }
+
+  uint32_t NewLabel() {
+    labels.push_back(UNBOUND);
+    return static_cast<uint32_t>(labels.size() - 1);
+  }
+  void Bind(uint32_t label) { labels[label] = buf.size(); }
+  void Jcc(Cond cond, uint32_t label) {
+    Byte(0x0F); Byte(static_cast<uint8_t>(0x80 | cond));
+    fixups.push_back({buf.size(), label});
+    U32(0);
+  }
+  void Jmp(uint32_t label) {
+    Byte(0xE9);
+    fixups.push_back({buf.size(), label});
+    U32(0);
+  }
+
+  void CallFunction(double (*fn)(double, double)) {
+    Byte(0x48); Byte(0xB8); U64(reinterpret_cast<uint64_t>(fn));   // mov rax, imm64
+    Byte(0xFF); Byte(0xD0);                                        // call rax
+  }
+
+  // -- Code generation --
+
+  static bool IsLeaf(ASTNode::Type type) { return type == ASTNode::VARIABLE || type == ASTNode::NUMBER; }
+
+  // Load a leaf operand into `reg`.
+  void LoadLeaf(node_t node, int reg) {
+    if (ast.GetType(node) == ASTNode::VARIABLE) LoadSlot(reg, static_cast<uint32_t>(ast.GetVarID(node)));
+    else LoadConst(reg, ast.GetValue(node));
+  }
+
+  // Evaluate the operands of a binary operator into xmm `depth` and a returned register.
+  // A leaf rhs goes straight into the scratch register instead of using another level.
+  bool GenOperands(node_t node, int depth, int & rhs_reg) {
+    if (!Gen(ast.GetChild(node, 0), depth)) return false;
+    const node_t rhs = ast.GetChild(node, 1);
+    if (IsLeaf(ast.GetType(rhs))) {
+      LoadLeaf(rhs, SCRATCH);
+      rhs_reg = SCRATCH;
+      return true;
+    }
+    rhs_reg = depth + 1;
+    return Gen(rhs, depth + 1);
+  }
+
+  bool GenMath(node_t node, int depth) {
+    int rhs = 0;
+    if (!GenOperands(node, depth, rhs)) return false;
+    switch (ast.GetOp(node)) {
+    case L::ID_PLUS: SseRR(0xF2, 0x58, depth, rhs); return true;
+    case L::ID_MINUS: SseRR(0xF2, 0x5C, depth, rhs); return true;
+    case L::ID_TIMES: SseRR(0xF2, 0x59, depth, rhs); return true;
+    case L::ID_DIVIDE:
+      TestZero(rhs);
+      Jcc(JE, div_error);
+      SseRR(0xF2, 0x5E, depth, rhs);
+      return true;
+    case L::ID_MODULUS:
+      TestZero(rhs);
+      Jcc(JE, mod_error);
+      GenCall(static_cast<double (*)(double, double)>(std::fmod), depth, rhs);
+      return true;
+    case L::ID_POWER:
+      GenCall(static_cast<double (*)(double, double)>(std::pow), depth, rhs);
+      return true;
+    }
+    return false;
+  }
+
+  // xmm[depth] = fn(xmm[depth], xmm[rhs]); every xmm register is caller-saved, so spill the
+  // live ones below `depth` around the call.
+  void GenCall(double (*fn)(double, double), int depth, int rhs) {
+    for (int i = 0; i < depth; ++i) SseRM(0xF2, 0x11, i, RSP, 8 * i);
+    MoveReg(0, depth);
+    MoveReg(1, rhs);
+    CallFunction(fn);
+    MoveReg(depth, 0);
+    for (int i = 0; i < depth; ++i) SseRM(0xF2, 0x10, i, RSP, 8 * i);
+  }
+
+  bool GenCompare(node_t node, int depth) {
+    int rhs = 0;
+    if (!GenOperands(node, depth, rhs)) return false;
+    // cmpsd predicates: 0 = EQ, 1 = LT, 2 = LE, 4 = NEQ (true when unordered, like C++ !=).
+    uint8_t pred = 0;
+    bool swap = false;
+    switch (ast.GetOp(node)) {
+    case L::ID_LESS: pred = 1; break;
+    case L::ID_LESS_EQUAL: pred = 2; break;
+    case L::ID_GREATER: pred = 1; swap = true; break;
+    case L::ID_GREATER_EQUAL: pred = 2; swap = true; break;
+    case L::ID_EQUAL: pred = 0; break;
+    case L::ID_NOT_EQUAL: pred = 4; break;
+    default: return false;
+    }
+    if (swap) {
+      SseRR(0xF2, 0xC2, rhs, depth); Byte(pred);
+      MoveReg(depth, rhs);
+    } else {
+      SseRR(0xF2, 0xC2, depth, rhs); Byte(pred);
+    }
+    ToOneOrZero(depth);
+    return true;
+  }
+
+  // Turn an all-ones/all-zeros compare mask into 1.0 or 0.0.
+  void ToOneOrZero(int reg) {
+    LoadConst(SCRATCH, 1.0);
+    SseRR(0x66, 0x54, reg, SCRATCH);   // andpd
+  }
+
+  bool GenLogical(node_t node, int depth) {
+    const bool is_and = (ast.GetOp(node) == L::ID_AND);
+    const uint32_t is_true = NewLabel();
+    const uint32_t is_false = NewLabel();
+    const uint32_t done = NewLabel();
+    if (!Gen(ast.GetChild(node, 0), depth)) return false;
+    TestZero(depth);
+    Jcc(is_and ? JE : JNE, is_and ? is_false : is_true);
+    if (!Gen(ast.GetChild(node, 1), depth)) return false;
+    TestZero(depth);
+    Jcc(JE, is_false);
+    Bind(is_true);
+    LoadConst(depth, 1.0);
+    Jmp(done);
+    Bind(is_false);
+    Zero(depth);
+    Bind(done);
+    return true;
+  }
+
+  // Evaluate an expression into xmm[depth].
+  bool Gen(node_t node, int depth) {
+    if (depth > MAX_REG) return false;
+    switch (ast.GetType(node)) {
+    case ASTNode::NUMBER:
+    case ASTNode::VARIABLE:
+      LoadLeaf(node, depth);
+      return true;
+    case ASTNode::PARENTH:
+      return Gen(ast.GetChild(node, 0), depth);
+    case ASTNode::ASSIGN:
+      if (!Gen(ast.GetChild(node, 1), depth)) return false;
+      StoreSlot(depth, static_cast<uint32_t>(ast.GetVarID(ast.GetChild(node, 0))));
+      return true;
+    case ASTNode::MATH_OP:
+      return GenMath(node, depth);
+    case ASTNode::COMP_OP:
+      return GenCompare(node, depth);
+    case ASTNode::LOGICAL_OP:
+      return GenLogical(node, depth);
+    case ASTNode::MODIFIER:
+      if (!Gen(ast.GetChild(node, 0), depth)) return false;
+      if (ast.GetOp(node) == L::ID_MINUS) {
+        LoadConst(SCRATCH, -1.0);
+        SseRR(0xF2, 0x59, depth, SCRATCH);       // mulsd: same as `value * -1`
+      } else {
+        Zero(SCRATCH);
+        SseRR(0xF2, 0xC2, depth, SCRATCH); Byte(0);   // cmpeqsd
+        ToOneOrZero(depth);
+      }
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Jump to `target` if a condition is false.  Comparisons branch on the flags directly.
+  bool GenJumpIfFalse(node_t cond, uint32_t target) {
+    while (ast.GetType(cond) == ASTNode::PARENTH) cond = ast.GetChild(cond, 0);
+    if (ast.GetType(cond) != ASTNode::COMP_OP) {
+      if (!Gen(cond, 0)) return false;
+      TestZero(0);
+      Jcc(JE, target);
+      return true;
+    }
+    int rhs = 0;
+    if (!GenOperands(cond, 0, rhs)) return false;
+    SseRR(0x66, 0x2E, 0, rhs);   // ucomisd xmm0, rhs; unordered sets ZF, PF and CF
+    switch (ast.GetOp(cond)) {
+    case L::ID_LESS: Jcc(JP, target); Jcc(JAE, target); return true;
+    case L::ID_LESS_EQUAL: Jcc(JP, target); Jcc(JA, target); return true;
+    case L::ID_GREATER: Jcc(JBE, target); return true;
+    case L::ID_GREATER_EQUAL: Jcc(JB, target); return true;
+    case L::ID_EQUAL: Jcc(JP, target); Jcc(JNE, target); return true;
+    case L::ID_NOT_EQUAL: {
+      const uint32_t is_true = NewLabel();
+      Jcc(JP, is_true);
+      Jcc(JE, target);
+      Bind(is_true);
+      return true;
+    }
+    }
+    return false;
+  }
+
+  bool GenLoop(node_t node) {
+    const uint32_t top = NewLabel();
+    const uint32_t end = NewLabel();
+    Bind(top);
+    if (!GenJumpIfFalse(ast.GetChild(node, 0), end)) return false;
+    if (ast.NumChildren(node) > 1 && !GenStatement(ast.GetChild(node, 1))) return false;
+    Jmp(top);
+    Bind(end);
+    return true;
+  }
+
+  bool GenStatement(node_t node) {
+    switch (ast.GetType(node)) {
+    case ASTNode::EMPTY:
+    case ASTNode::NUMBER:
+    case ASTNode::VARIABLE:
+      return true;
+    case ASTNode::SCOPE:
+      for (node_t i = 0; i < ast.NumChildren(node); ++i) {
+        if (!GenStatement(ast.GetChild(node, i))) return false;
+      }
+      return true;
+    case ASTNode::IF: {
+      const uint32_t to_else = NewLabel();
+      if (!GenJumpIfFalse(ast.GetChild(node, 0), to_else)) return false;
+      if (!GenStatement(ast.GetChild(node, 1))) return false;
+      if (ast.NumChildren(node) > 2) {
+        const uint32_t end = NewLabel();
+        Jmp(end);
+        Bind(to_else);
+        if (!GenStatement(ast.GetChild(node, 2))) return false;
+        Bind(end);
+      } else {
+        Bind(to_else);
+      }
+      return true;
+    }
+    case ASTNode::WHILE:
+      return GenLoop(node);
+    default:
+      return Gen(node, 0);   // Expression statement; result discarded.
+    }
+  }
+
+public:
+  explicit JitCompiler(const ASTArena & ast) : ast(ast) { }
+
+  size_t NumLoops() const { return num_loops; }
+
+  /**
+   * Try to compile a WHILE node into a native function.
+   * On success returns true and sets `entry` to the function's offset in the final code.
+   */
+  bool CompileLoop(node_t node, size_t & entry) {
+#ifndef MACROCALC_HAS_JIT
+    (void) node; (void) entry;
+    return false;
+#else
+    while (buf.size() % 16) Byte(0xCC);   // int3 padding; align each function
+    const size_t start = buf.size();
+    labels.clear();
+    fixups.clear();
+    div_error = NewLabel();
+    mod_error = NewLabel();
+    const uint32_t exit = NewLabel();
+
+    Byte(0x53);                                  // push rbx
+    Byte(0x48); Byte(0x89); Byte(0xFB);          // mov rbx, rdi
+    Byte(0x48); Byte(0x81); Byte(0xEC); U32(SPILL_BYTES);   // sub rsp, SPILL_BYTES
+    if (!GenLoop(node)) {
+      buf.resize(start);
+      return false;
+    }
+    Byte(0x31); Byte(0xC0);                      // xor eax, eax
+    Bind(exit);
+    Byte(0x48); Byte(0x81); Byte(0xC4); U32(SPILL_BYTES);   // add rsp, SPILL_BYTES
+    Byte(0x5B);                                  // pop rbx
+    Byte(0xC3);                                  // ret
+    Bind(div_error);
+    Byte(0xB8); U32(NativeCode::DIVISION_BY_ZERO);   // mov eax, status
+    Jmp(exit);
+    Bind(mod_error);
+    Byte(0xB8); U32(NativeCode::MODULUS_BY_ZERO);
+    Jmp(exit);
+
+    for (const Fixup & fixup : fixups) {
+      const int32_t rel = static_cast<int32_t>(labels[fixup.label] - (fixup.at + 4));
+      std::memcpy(&buf[fixup.at], &rel, sizeof(rel));
+    }
+    entry = start;
+    ++num_loops;
+    return true;
+#endif
+  }
+
+  // Move everything compiled so far into executable memory (nullptr if nothing was compiled).
+  std::shared_ptr<const NativeCode> Finish() {
+    if (!num_loops) return nullptr;
+    auto native = std::make_shared<const NativeCode>(buf);
+    if (!native->IsValid()) return nullptr;
+    return native;
+  }
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "OutputSink.hpp"
+
+/**
+ * AST optimization pass run between Parse() and Run().
+ *  - Folds operators whose operands are all number literals.
+ *  - Removes PARENTH wrappers.
+ *  - Simplifies identities: x*1, 1*x, x-0, x/1, and (in boolean context) x+0, 0+x, !!x.
+ *  - Turns constant print arguments into text and merges adjacent text.
+ * Division and modulus by a literal zero are left alone so they still fail at runtime.
+ */
+class Optimizer
+{
+public:
+  struct Stats {
+    size_t folded{0};           // Operators replaced by a literal
+    size_t parens_removed{0};   // PARENTH wrappers dropped
+    size_t identities{0};       // Identity operations simplified away
+    size_t print_inlined{0};    // Constant print arguments turned into text
+  };
+
+private:
+  Stats stats{};
+
+  using L = emplex::Lexer;
+
+  static bool IsNumber(const ASTNode & node) { return node.GetType() == ASTNode::NUMBER; }
+  static bool IsNumber(const ASTNode & node, double value) {
+    return IsNumber(node) && node.GetValue() == value;
+  }
+
+  static void MakeNumber(ASTNode & node, double value) {
+    const size_t line = node.GetLine();
+    node = ASTNode{ASTNode::NUMBER, value};
+    node.SetLine(line);
+  }
+
+  // Simplify an arithmetic identity by keeping only child `keep`.  x + 0 is only an identity
+  // in boolean context, because -0 + 0 is +0 and would print differently.
+  bool SimplifyIdentity(ASTNode & node, bool bool_context) {
+    const ASTNode & lhs = node.GetChild(0);
+    const ASTNode & rhs = node.GetChild(1);
+    int keep = -1;
+    switch (node.GetOp()) {
+    case L::ID_TIMES:
+      if (IsNumber(rhs, 1.0)) keep = 0;
+      else if (IsNumber(lhs, 1.0)) keep = 1;
+      break;
+    case L::ID_PLUS:
+      if (!bool_context) break;
+      if (IsNumber(rhs, 0.0)) keep = 0;
+      else if (IsNumber(lhs, 0.0)) keep = 1;
+      break;
+    case L::ID_MINUS:   // x - -0 is x + 0, which turns -0 into 0
+      if (IsNumber(rhs, 0.0) && !std::signbit(rhs.GetValue())) keep = 0;
+      break;
+    case L::ID_DIVIDE:   // Not x ** 1: pow(-nan, 1) is +nan
+      if (IsNumber(rhs, 1.0)) keep = 0;
+      break;
+    }
+    if (keep < 0) return false;
+    node.ReplaceWithChild(static_cast<size_t>(keep));
+    ++stats.identities;
+    return true;
+  }
+
+  void OptimizeLogical(ASTNode & node, bool bool_context) {
+    const bool is_and = (node.GetOp() == L::ID_AND);
+    const ASTNode & lhs = node.GetChild(0);
+    if (!IsNumber(lhs)) return;
+    const bool lhs_true = (lhs.GetValue() != 0.0);
+    // The lhs alone decides the result; the rhs is never evaluated.
+    if (is_and != lhs_true) {
+      MakeNumber(node, lhs_true ? 1.0 : 0.0);
+      ++stats.folded;
+      return;
+    }
+    // Otherwise the result is the truth value of the rhs.
+    if (IsNumber(node.GetChild(1))) {
+      MakeNumber(node, node.GetChild(1).GetValue() != 0.0 ? 1.0 : 0.0);
+      ++stats.folded;
+    } else if (bool_context) {
+      node.ReplaceWithChild(1);
+      ++stats.identities;
+    }
+  }
+
+  void OptimizePrint(ASTNode & node) {
+    std::vector<ASTNode> & children = node.GetChildren();
+    std::vector<ASTNode> merged;
+    merged.reserve(children.size());
+    for (ASTNode & child : children) {
+      if (IsNumber(child)) {
+        char digits[32];
+        const size_t line = child.GetLine();
+        child = ASTNode{ASTNode::STRING, std::string(digits, OutputSink::FormatNumber(child.GetValue(), digits))};
+        child.SetLine(line);
+        ++stats.print_inlined;
+      }
+      if (child.GetType() == ASTNode::STRING && merged.size()
+          && merged.back().GetType() == ASTNode::STRING) {
+        merged.back().SetStrValue(merged.back().GetStrValue() + child.GetStrValue());
+        continue;
+      }
+      merged.push_back(std::move(child));
+    }
+    children = std::move(merged);
+  }
+
+  // Is child `i` of `node` in boolean context, given the context of `node` itself?
+  static bool ChildContext(const ASTNode & node, size_t i, bool bool_context) {
+    const ASTNode::Type type = node.GetType();
+    return type == ASTNode::LOGICAL_OP || (type == ASTNode::MODIFIER && node.GetOp() == L::ID_NOT)
+      || ((type == ASTNode::IF || type == ASTNode::WHILE) && i == 0)
+      || (type == ASTNode::PARENTH && bool_context);
+  }
+
+  // Simplify one node whose children are already optimized.
+  void OptimizeNode(ASTNode & node, bool bool_context) {
+    const ASTNode::Type type = node.GetType();
+    const bool is_not = (type == ASTNode::MODIFIER && node.GetOp() == L::ID_NOT);
+    switch (type) {
+    case ASTNode::PARENTH:
+      node.ReplaceWithChild(0);
+      ++stats.parens_removed;
+      break;
+    case ASTNode::MODIFIER: {
+      const ASTNode & child = node.GetChild(0);
+      if (IsNumber(child)) {
+        MakeNumber(node, FoldUnary(node.GetOp(), child.GetValue()));
+        ++stats.folded;
+      } else if (is_not && bool_context && child.GetType() == ASTNode::MODIFIER
+                 && child.GetOp() == L::ID_NOT) {
+        node.GetChild(0).ReplaceWithChild(0);   // !!x -> x
+        node.ReplaceWithChild(0);
+        ++stats.identities;
+      }
+      break;
+    }
+    case ASTNode::MATH_OP:
+    case ASTNode::COMP_OP: {
+      double result = 0.0;
+      if (IsNumber(node.GetChild(0)) && IsNumber(node.GetChild(1))
+          && FoldBinary(node.GetOp(), node.GetChild(0).GetValue(), node.GetChild(1).GetValue(), result)) {
+        MakeNumber(node, result);
+        ++stats.folded;
+      } else if (type == ASTNode::MATH_OP) {
+        SimplifyIdentity(node, bool_context);
+      }
+      break;
+    }
+    case ASTNode::LOGICAL_OP:
+      OptimizeLogical(node, bool_context);
+      break;
+    case ASTNode::PRINT:
+      OptimizePrint(node);
+      break;
+    default:
+      break;
+    }
+  }
+
+public:
+  const Stats & GetStats() const { return stats; }
+
+  // Evaluate a binary operator on literals, exactly as the interpreters do.
+  // Returns false if the operator must be left for runtime (e.g., division by zero).
+  static bool FoldBinary(int op, double lhs, double rhs, double & result) {
+    switch (op) {
+    case L::ID_PLUS: result = lhs + rhs; return true;
+    case L::ID_MINUS: result = lhs - rhs; return true;
+    case L::ID_TIMES: result = lhs * rhs; return true;
+    case L::ID_DIVIDE: if (rhs == 0) return false; result = lhs / rhs; return true;
+    case L::ID_MODULUS: if (rhs == 0) return false; result = std::fmod(lhs, rhs); return true;
+    case L::ID_POWER: result = std::pow(lhs, rhs); return true;
+    case L::ID_LESS: result = lhs < rhs ? 1.0 : 0.0; return true;
+    case L::ID_LESS_EQUAL: result = lhs <= rhs ? 1.0 : 0.0; return true;
+    case L::ID_GREATER: result = lhs > rhs ? 1.0 : 0.0; return true;
+    case L::ID_GREATER_EQUAL: result = lhs >= rhs ? 1.0 : 0.0; return true;
+    case L::ID_EQUAL: result = lhs == rhs ? 1.0 : 0.0; return true;
+    case L::ID_NOT_EQUAL: result = lhs != rhs ? 1.0 : 0.0; return true;
+    }
+    return false;
+  }
+
+  // Evaluate a unary modifier (negation or logical not) on a literal.
+  static double FoldUnary(int op, double value) {
+    return op == L::ID_NOT ? (value == 0.0 ? 1.0 : 0.0) : value * -1;
+  }
+
+  // Optimize a subtree in place.  In boolean context only the truth of the value matters.
+  // Children are optimized before their parent, visited from an explicit stack so that trees
+  // of any depth work.
+  void Optimize(ASTNode & root, bool bool_context = false) {
+    struct Visit {
+      ASTNode * node;
+      bool bool_context;
+      size_t next_child;
+    };
+    std::vector<Visit> stack{{&root, bool_context, 0}};
+    while (stack.size()) {
+      Visit & visit = stack.back();
+      ASTNode & node = *visit.node;
+      if (visit.next_child < node.GetChildren().size()) {
+        const size_t i = visit.next_child++;
+        const bool child_bool = ChildContext(node, i, visit.bool_context);
+        stack.push_back({&node.GetChild(i), child_bool, 0});
+        continue;
+      }
+      const bool context = visit.bool_context;
+      stack.pop_back();
+      OptimizeNode(node, context);
+    }
+  }
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "BytecodeCache.hpp"
+#include "SourceBuffer.hpp"
+
+/**
+ * Remembers the complete result of running a script: every byte it printed and how it ended.
+ * Scripts read no input, so the result depends only on the source text and the interpreter;
+ * a hit replays the stored bytes without parsing or running anything.
+ * Entries live one per file in a directory, named by a hash of the source and the build id, so
+ * a rebuilt interpreter never replays what an older one printed.  The directory is kept under a byte limit by evicting the least recently used entries, where a
+ * hit refreshes an entry's modification time.
+ */
+class OutputMemo
+{
+private:
+  static constexpr char MAGIC[8] = {'M', 'C', 'M', 'E', 'M', 'O', '\0', '\0'};
+
+  struct Header {
+    char magic[8];
+    uint32_t version;        // FORMAT_VERSION
+    uint32_t status;         // 0 if the script finished, 1 if it stopped with an error
+    uint64_t build_id;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint64_t error_line;     // As MacroCalcError::GetLine()
+    uint64_t error_size;
+    uint64_t output_size;
+    uint64_t body_hash;      // Hash of the error message and output that follow
+  };
+
+  std::filesystem::path dir;
+  uintmax_t max_bytes;
+
+  // Remove the least recently used entries until the directory fits in max_bytes.
+  void Evict() const {
+    struct Entry {
+      std::filesystem::file_time_type used;
+      uintmax_t size;
+      std::filesystem::path path;
+    };
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+    std::error_code error;
+    for (const auto & file : std::filesystem::directory_iterator(dir, error)) {
+      if (file.path().extension() != ".memo") continue;
+      const uintmax_t size = file.file_size(error);
+      if (error) continue;
+      entries.push_back({file.last_write_time(error), size, file.path()});
+      total += size;
+    }
+    if (total <= max_bytes) return;
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry & lhs, const Entry & rhs) { return lhs.used < rhs.used; });
+    for (const Entry & entry : entries) {
+      if (total <= max_bytes) break;
+      if (std::filesystem::remove(entry.path, error)) total -= entry.size;
+    }
+  }
+
+public:
+  // Bump whenever the layout of an entry changes.
+  static constexpr uint32_t FORMAT_VERSION = 2;
+  static constexpr uintmax_t DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+
+  struct Result {
+    int status{0};
+    size_t error_line{0};
+    std::string error{};     // MacroCalcError::GetMessage(), if status is 1
+    std::string output{};
+  };
+
+  OutputMemo(std::filesystem::path dir, uintmax_t max_bytes = DEFAULT_MAX_BYTES)
+    : dir(std::move(dir)), max_bytes(max_bytes) { }
+
+  std::filesystem::path EntryPath(uint64_t source_hash) const {
+    char name[32];
+    const uint64_t key = source_hash ^ (BytecodeCache::BuildId() + FORMAT_VERSION) * 0x9e3779b97f4a7c15ull;
+    std::snprintf(name, sizeof(name), "%016llx.memo", static_cast<unsigned long long>(key));
+    return dir / name;
+  }
+
+  // Look up the stored result of running `source`.
+  bool Load(std::string_view source, Result & result) const {
+    const uint64_t source_hash = BytecodeCache::Hash(source);
+    const std::filesystem::path path = EntryPath(source_hash);
+    SourceBuffer entry;
+    if (!entry.Load(path.string())) return false;
+    const std::string_view data = entry.View();
+
+    Header header;
+    if (data.size() < sizeof(Header)) return false;
+    std::memcpy(&header, data.data(), sizeof(Header));
+    const std::string_view body = data.substr(sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != FORMAT_VERSION
+        || header.build_id != BytecodeCache::BuildId() || header.source_hash != source_hash
+        || header.source_size != source.size()
+        || header.status > 1 || header.error_size > body.size()
+        || header.output_size != body.size() - header.error_size
+        || header.body_hash != BytecodeCache::Hash(body)) {
+      return false;
+    }
+
+    result.status = static_cast<int>(header.status);
+    result.error_line = header.error_line;
+    result.error.assign(body.substr(0, header.error_size));
+    result.output.assign(body.substr(header.error_size));
+
+    std::error_code error;   // Mark as recently used.
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    return true;
+  }
+
+  // Record the result of running `source`, then trim the directory back under its limit.
+  // Failures are ignored: the memo is only an accelerator.
+  void Store(std::string_view source, const Result & result) const {
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.build_id = BytecodeCache::BuildId();
+    header.status = result.status ? 1 : 0;
+    header.source_hash = BytecodeCache::Hash(source);
+    header.source_size = source.size();
+    header.error_line = result.error_line;
+    header.error_size = result.error.size();
+    header.output_size = result.output.size();
+    if (sizeof(Header) + header.error_size + header.output_size > max_bytes) return;
+
+    std::string body = result.error + result.output;
+    header.body_hash = BytecodeCache::Hash(body);
+
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    const std::filesystem::path path = EntryPath(header.source_hash);
+    std::filesystem::path temp = path;
+    temp += ".tmp" + std::to_string(std::random_device{}());
+    {
+      std::ofstream file(temp, std::ios::binary);
+      file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      if (!file.write(body.data(), static_cast<std::streamsize>(body.size()))) {
+        file.close();
+        std::filesystem::remove(temp, error);
+        return;
+      }
+    }
+    std::filesystem::rename(temp, path, error);
+    if (error) {
+      std::filesystem::remove(temp, error);
+      return;
+    }
+    Evict();
+  }
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+/**
+ * Buffered destination for PRINT output.
+ * Bytes accumulate in memory and are written out only when the buffer reaches its flush size,
+ * when Flush() is called, or when the sink is destroyed.  A sink either writes to a FILE*,
+ * collects everything into a string (target == nullptr), or tees: it passes everything on to
+ * another sink while keeping a copy of the first bytes, up to a limit.
+ */
+class OutputSink
+{
+private:
+  std::FILE * target;
+  size_t flush_size;
+  std::string buffer{};
+  size_t bytes_written{0};   // Total bytes handed to this sink
+  OutputSink * next{nullptr};   // For tee sinks: where flushed bytes go
+  std::string copy{};           // For tee sinks: everything passed on, while it fits copy_limit
+  size_t copy_limit{0};
+  bool copy_complete{true};
+
+public:
+  static constexpr size_t DEFAULT_FLUSH_SIZE = 64 * 1024;
+
+  explicit OutputSink(std::FILE * target = nullptr, size_t flush_size = DEFAULT_FLUSH_SIZE)
+    : target(target), flush_size(flush_size) { buffer.reserve(flush_size); }
+  // A tee sink: writes reach `next` as they would have directly, and a copy is kept while
+  // the total stays within `copy_limit` bytes.
+  OutputSink(OutputSink & next, size_t copy_limit)
+    : target(nullptr), flush_size(next.flush_size), next(&next), copy_limit(copy_limit) { }
+  OutputSink(const OutputSink &) = delete;
+  OutputSink & operator=(const OutputSink &) = delete;
+  ~OutputSink() { Flush(); }
+
+  // The process-wide sink for stdout; as a function-local static it is flushed at exit().
+  static OutputSink & Stdout() {
+    static OutputSink sink(stdout);
+    return sink;
+  }
+
+  void SetFlushSize(size_t size) { flush_size = size; }
+  size_t GetBytesWritten() const { return bytes_written; }
+
+  // For string sinks: everything written so far.
+  const std::string & GetBuffer() const { return buffer; }
+
+  // For tee sinks: everything passed on so far, if it all fit in the copy limit.
+  const std::string & GetCopy() const { return copy; }
+  bool IsCopyComplete() const { return copy_complete; }
+
+  void Flush() {
+    if (next) {
+      if (copy_complete && copy.size() + buffer.size() <= copy_limit) copy.append(buffer);
+      else if (copy_complete) {
+        copy_complete = false;
+        std::string().swap(copy);   // Too big to keep; stop collecting and free the memory.
+      }
+      next->Write(buffer);
+      buffer.clear();
+      return;
+    }
+    if (!target || buffer.empty()) return;
+    std::fwrite(buffer.data(), 1, buffer.size(), target);
+    std::fflush(target);
+    buffer.clear();
+  }
+
+  void Write(std::string_view text) {
+    buffer.append(text);
+    bytes_written += text.size();
+    if (buffer.size() >= flush_size && (target || next)) Flush();
+  }
+
+  void Write(char c) {
+    buffer.push_back(c);
+    ++bytes_written;
+    if (buffer.size() >= flush_size && (target || next)) Flush();
+  }
+
+  void WriteNumber(double value) {
+    char digits[32];
+    Write(std::string_view(digits, FormatNumber(value, digits)));
+  }
+
+  /**
+   * Format a double exactly as `std::cout << value` would with default stream settings
+   * (equivalent to printf's %g with precision 6).  Writes at most 32 bytes; returns the length.
+   */
+  static size_t FormatNumber(double value, char * out) {
+    // Whole numbers below 1e6 print as plain integers; skip the general-format machinery.
+    if (value == std::trunc(value) && std::fabs(value) < 1e6 && !(value == 0 && std::signbit(value))) {
+      return static_cast<size_t>(std::to_chars(out, out + 32, static_cast<long>(value)).ptr - out);
+    }
+    return static_cast<size_t>(std::to_chars(out, out + 32, value, std::chars_format::general, 6).ptr - out);
+  }
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "SymbolTable.hpp"
+
+/**
+ * One piece of a print string: either literal text or a `{name}` variable reference.
+ * Both are views into the source text.
+ */
+struct PrintSegment {
+  enum Kind { TEXT, VARIABLE };
+  Kind kind;
+  std::string_view text;   // Literal text, or the variable name for VARIABLE segments
+};
+
+/**
+ * Split the body of a print string literal (without its quotes) into segments in one pass.
+ * Text outside braces becomes TEXT segments; each `{name}` becomes a VARIABLE segment.
+ * A '{' without a matching '}' is an error.
+ */
+inline std::vector<PrintSegment> CompilePrintTemplate(std::string_view body, size_t line_num)
+{
+  std::vector<PrintSegment> segments;
+  size_t pos = 0;
+  while (pos < body.size()) {
+    const size_t open = body.find('{', pos);
+    if (open == std::string_view::npos) {
+      segments.push_back({PrintSegment::TEXT, body.substr(pos)});
+      break;
+    }
+    if (open > pos) segments.push_back({PrintSegment::TEXT, body.substr(pos, open - pos)});
+
+    const size_t close = body.find('}', open + 1);
+    if (close == std::string_view::npos) {
+      Error(line_num, "Missing '}' after '{' in print string.");
+    }
+    segments.push_back({PrintSegment::VARIABLE, body.substr(open + 1, close - open - 1)});
+    pos = close + 1;
+  }
+  return segments;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ASTNode.hpp"
+
+/**
+ * Execution profile for the tree walker: how often each AST node was evaluated and how long
+ * it took, both including its children (total) and excluding them (self).
+ * Nodes carry the source line they came from, so results roll up into a per-line report.
+ * Every node's path from the root is unique, so the same data also gives exact "folded stack"
+ * lines (frame;frame;frame weight) for flame-graph tools.
+ */
+class Profiler
+{
+public:
+  struct Stat {
+    uint64_t count{0};
+    uint64_t total_ns{0};   // Including children
+    uint64_t child_ns{0};   // Time spent in children
+    uint64_t SelfNs() const { return total_ns - std::min(child_ns, total_ns); }
+  };
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  std::unordered_map<const ASTNode *, Stat> stats{};
+  std::vector<Stat *> active{};   // Nodes currently being evaluated, innermost last
+
+  // Ends the measurement of one evaluation, including when it unwinds on an error.
+  class Timer {
+  private:
+    Profiler & profiler;
+    Stat & stat;
+    clock::time_point start;
+
+  public:
+    Timer(Profiler & profiler, Stat & stat) : profiler(profiler), stat(stat), start(clock::now()) { }
+    ~Timer() {
+      const uint64_t elapsed = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+      stat.total_ns += elapsed;
+      profiler.active.pop_back();
+      if (!profiler.active.empty()) profiler.active.back()->child_ns += elapsed;
+    }
+  };
+
+  static const char * TypeName(ASTNode::Type type) {
+    switch (type) {
+    case ASTNode::EMPTY: return "EMPTY";
+    case ASTNode::SCOPE: return "SCOPE";
+    case ASTNode::VARIABLE: return "VARIABLE";
+    case ASTNode::NUMBER: return "NUMBER";
+    case ASTNode::STRING: return "STRING";
+    case ASTNode::VAR: return "VAR";
+    case ASTNode::ASSIGN: return "ASSIGN";
+    case ASTNode::PRINT: return "PRINT";
+    case ASTNode::IF: return "IF";
+    case ASTNode::WHILE: return "WHILE";
+    case ASTNode::EXPR: return "EXPR";
+    case ASTNode::MATH_OP: return "MATH_OP";
+    case ASTNode::COMP_OP: return "COMP_OP";
+    case ASTNode::LOGICAL_OP: return "LOGICAL_OP";
+    case ASTNode::MODIFIER: return "MODIFIER";
+    case ASTNode::PARENTH: return "PARENTH";
+    }
+    return "UNKNOWN";
+  }
+
+  struct LineStat {
+    size_t line{0};
+    uint64_t runs{0};      // Evaluations of the most-evaluated node on the line
+    uint64_t self_ns{0};
+  };
+
+  // Visit every profiled node with its effective line (nodes without one take their parent's).
+  template <typename FN>
+  void Walk(const ASTNode & node, size_t parent_line, FN && visit) const {
+    const size_t line = node.GetLine() ? node.GetLine() : parent_line;
+    auto it = stats.find(&node);
+    if (it == stats.end()) return;   // Never evaluated, so neither were its children
+    visit(node, line, it->second);
+    for (const ASTNode & child : node.GetChildren()) Walk(child, line, visit);
+  }
+
+  void WriteFolded(const ASTNode & node, size_t parent_line, std::string & stack, std::ostream & os) const {
+    auto it = stats.find(&node);
+    if (it == stats.end()) return;
+    const size_t line = node.GetLine() ? node.GetLine() : parent_line;
+    const size_t old_size = stack.size();
+    if (!stack.empty()) stack += ';';
+    stack += TypeName(node.GetType());
+    stack += ":" + std::to_string(line);
+    if (it->second.SelfNs()) os << stack << ' ' << it->second.SelfNs() << '\n';
+    for (const ASTNode & child : node.GetChildren()) WriteFolded(child, line, stack, os);
+    stack.resize(old_size);
+  }
+
+  static std::string_view SourceLine(std::string_view source, size_t line) {
+    for (size_t cur = 1; cur < line; ++cur) {
+      const size_t newline = source.find('\n');
+      if (newline == std::string_view::npos) return {};
+      source.remove_prefix(newline + 1);
+    }
+    source = source.substr(0, source.find('\n'));
+    const size_t start = source.find_first_not_of(" \t");
+    if (start == std::string_view::npos) return {};
+    source = source.substr(start, source.find_last_not_of(" \t\r") - start + 1);
+    return source.substr(0, 60);
+  }
+
+public:
+  // Evaluate `node` by calling run(), recording the count and time.
+  template <typename FN>
+  double Measure(const ASTNode & node, FN && run) {
+    Stat & stat = stats[&node];
+    ++stat.count;
+    active.push_back(&stat);
+    Timer timer(*this, stat);
+    return run();
+  }
+
+  // The statistics for one node, or nullptr if it was never evaluated.
+  const Stat * Find(const ASTNode & node) const {
+    auto it = stats.find(&node);
+    return it == stats.end() ? nullptr : &it->second;
+  }
+
+  // Lines sorted by self time, hottest first, with the text of each line.
+  void WriteReport(const ASTNode & root, std::string_view source, std::ostream & os,
+                   size_t max_lines = 20) const {
+    std::unordered_map<size_t, LineStat> by_line;
+    uint64_t evaluations = 0;
+    uint64_t total_ns = 0;
+    Walk(root, 0, [&](const ASTNode &, size_t line, const Stat & stat) {
+      LineStat & entry = by_line[line];
+      entry.line = line;
+      entry.runs = std::max(entry.runs, stat.count);
+      entry.self_ns += stat.SelfNs();
+      evaluations += stat.count;
+      total_ns += stat.SelfNs();
+    });
+    std::vector<LineStat> lines;
+    for (const auto & [line, entry] : by_line) lines.push_back(entry);
+    std::sort(lines.begin(), lines.end(), [](const LineStat & lhs, const LineStat & rhs) {
+      return lhs.self_ns != rhs.self_ns ? lhs.self_ns > rhs.self_ns : lhs.line < rhs.line;
+    });
+
+    char row[128];
+    std::snprintf(row, sizeof(row), "Profile: %.3f ms in %llu node evaluations\n",
+                  static_cast<double>(total_ns) / 1e6, static_cast<unsigned long long>(evaluations));
+    os << row << "   line     self ms      %          runs  source\n";
+    for (size_t i = 0; i < lines.size() && i < max_lines; ++i) {
+      const LineStat & entry = lines[i];
+      const double percent = total_ns ? 100.0 * static_cast<double>(entry.self_ns) / static_cast<double>(total_ns) : 0.0;
+      std::snprintf(row, sizeof(row), "%7zu %11.3f %5.1f%% %13llu  ", entry.line,
+                    static_cast<double>(entry.self_ns) / 1e6, percent,
+                    static_cast<unsigned long long>(entry.runs));
+      os << row << (entry.line ? SourceLine(source, entry.line) : "(top level)") << '\n';
+    }
+  }
+
+  // One line per evaluated node with self time: "SCOPE:0;WHILE:3;ASSIGN:4 <nanoseconds>".
+  void WriteFolded(const ASTNode & root, std::ostream & os) const {
+    std::string stack;
+    WriteFolded(root, 0, stack, os);
+  }
+};
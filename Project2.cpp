@@ -1,715 +1,312 @@
-#include <cassert>
+#include <charconv>
 #include <fstream>
 #include <iostream>
 #include <string>
-#include <sstream>
-#include <unordered_map>
-#include <set>
-#include <regex>
 #include <vector>
-#include <assert.h>
 
-// Below are some suggestions on how you might want to divide up your project.
-// You may delete this and divide it up however you like.
-#include "ASTNode.hpp"
-#include "lexer.hpp"
-#include "SymbolTable.hpp"
-
-// Using
-using std::string;
-using std::endl;
-
-
-
-class MacroCalc {
-  private:
-    std::vector<emplex::Token> tokens{};
-    size_t token_id{0};
-    ASTNode root{ASTNode::SCOPE};
-
-    SymbolTable symbols{};
-
-    std::string TokenName(int id) const {
-      if (id > 0 && id < 128) {
-        return std::string("'") + static_cast<char>(id) + "'";
-      }
-      return emplex::Lexer::TokenName(id);
-    }
-
-    emplex::Token CurToken() const { return tokens[token_id]; }
-
-    emplex::Token UseToken() { return tokens[token_id++]; }
-
-    emplex::Token UseToken(int required_id, std::string err_message="") {
-      if (CurToken() != required_id) {
-        if (err_message.size()) Error(CurToken(), err_message);
-        else {
-          Error(CurToken(),
-            "Expected token type ", TokenName(required_id),
-            ", but found ", TokenName(CurToken())
-          );
-        }
-      }
-      return UseToken();
-    }
-
-    bool UseTokenIf(int test_id) {
-      if (CurToken() == test_id) {
-        token_id++;
-        return true;
-      }
-      return false;
-    }
-
-    ASTNode MakeVarNode(const emplex::Token & token) {
-      size_t var_id = symbols.GetVarID(token.lexeme);
-      assert(var_id < symbols.GetNumVars());
-      ASTNode out(ASTNode::VARIABLE);
-      out.SetVarID(var_id);
-      return out;
-    }
-
-  public:
-    MacroCalc(std::string filename) {
-      std::ifstream file(filename);
-      emplex::Lexer lexer;
-      tokens = lexer.Tokenize(file);
-
-      Parse();
-    }
-
-    void Parse() {
-      while (token_id < tokens.size()) {
-        ASTNode cur_node = ParseStatement();
-        if (cur_node.GetType()) root.AddChild(cur_node);
-      }
-    }
-
-    ASTNode ParseStatement() {
-      switch (CurToken()) {
-      using namespace emplex;
-      case Lexer::ID_BEGINSCOPE : return ParseScope();
-      case Lexer::ID_VAR : return ParseDeclare();
-      case Lexer::ID_IDENTIFIER : return ParseAssign();
-      case Lexer::ID_PRINT : return ParsePrint();
-      case Lexer::ID_IF: return ParseIf();
-      case Lexer::ID_WHILE: return ParseWhile();
-      case Lexer::ID_SEMICOLON: return ASTNode{};
-      default:
-        return ParseExpression();
-      }
-    }
-
-  ASTNode ParsePrint() {
-    UseToken(emplex::Lexer::ID_PRINT);
-    UseToken(emplex::Lexer::ID_OPENPAREN);
-
-    ASTNode print_node{ASTNode::PRINT};
-
-    /**If the print argument is a string literal we parse it for variables in braces using regex and add
-     * either variable children or string children to the print node
-    **/
-    if (CurToken() == emplex::Lexer::ID_STRINGLITERAL) {
-
-      std::regex var_pattern("\\{(.*?)\\}");
-      std::smatch match;
-      std::string lexeme = CurToken().lexeme.substr(1, CurToken().lexeme.size() - 2);
-      std::string::const_iterator search_start(lexeme.cbegin());
-
-      size_t last_pos = 0;
-
-      while (std::regex_search(search_start, lexeme.cend(), match, var_pattern)) {
-        // Add the string part before the variable
-        if (std::distance(lexeme.cbegin(), search_start) + match.position() > last_pos) {
-            std::string literalString = lexeme.substr(last_pos, match.position());
-            ASTNode string_node{ASTNode::STRING};
-            string_node.SetStrValue(literalString);
-            print_node.AddChild(string_node);
-        }
-
-        // Add the variable node
-        std::string var_name = match[1];
-        ASTNode var_node{ASTNode::VARIABLE};
-        var_node.SetVarID(symbols.GetVarID(var_name));
-        print_node.AddChild(var_node);
-
-        // Move the search start position
-        last_pos = std::distance(lexeme.cbegin(), search_start) + match.position() + match.length();
-        search_start = match.suffix().first;
-      }
-
-      // Add any remaining string after the last variable
-      if (last_pos < lexeme.length()) {
-          ASTNode second_string_node{ASTNode::STRING};
-          second_string_node.SetStrValue(lexeme.substr(last_pos));
-          print_node.AddChild(second_string_node);
-      }
-      UseToken();
-    }
-    //If it's not as string literal it's assumed to be an expression and appended as a child
-    else {
-      print_node.AddChild(ParseExpression());
-    }
-
-    UseToken(emplex::Lexer::ID_CLOSEPAREN);
-    UseToken(emplex::Lexer::ID_SEMICOLON);
-
-    return print_node;
-  }
-
-  ASTNode ParseScope() {
-    UseToken(emplex::Lexer::ID_BEGINSCOPE);
-
-    ASTNode scope(ASTNode::SCOPE);
-
-    symbols.PushScope();
-
-    while(CurToken() != emplex::Lexer::ID_ENDSCOPE) {
-      scope.AddChild(ParseStatement());
-    }
-    symbols.PopScope();
-
-    UseToken();
-    return scope;
-  }
-
-  //Handles variable declarations ex: var x = 10;
-  ASTNode ParseDeclare() {
-    UseToken(emplex::Lexer::ID_VAR);
-    auto id_token = UseToken(emplex::Lexer::ID_IDENTIFIER);
-    symbols.AddVar(id_token.lexeme, id_token.line_id);
-
-    if (UseTokenIf(emplex::Lexer::ID_SEMICOLON)) return ASTNode{};
-
-    UseToken(emplex::Lexer::ID_ASSIGN, "Expected ';' or '='.");
-
-    auto lhs_node = MakeVarNode(id_token);
-    auto rhs_node = ParseExpression();
-    UseToken(emplex::Lexer::ID_SEMICOLON);
-
-    return ASTNode{ASTNode::ASSIGN, lhs_node, rhs_node};
-
-  }
-
-  //Handles variable reassignment ex: x = 10;
-  ASTNode ParseAssign() {
-    auto id_token = UseToken(emplex::Lexer::ID_IDENTIFIER);
-
-    UseToken(emplex::Lexer::ID_ASSIGN, "Expected '='.");
-
-    auto lhs_node = MakeVarNode(id_token);
-    auto rhs_node = ParseExpression();
-    UseToken(emplex::Lexer::ID_SEMICOLON);
-
-    return ASTNode{ASTNode::ASSIGN, lhs_node, rhs_node};
-  }
-
-  ASTNode ParseIf() {
-    ASTNode if_node{ASTNode::IF};
-
-    UseToken(emplex::Lexer::ID_IF);
-    UseToken(emplex::Lexer::ID_OPENPAREN);
+#include "BytecodeCache.hpp"
+#include "MacroCalc.hpp"
+#include "OutputMemo.hpp"
+#include "ThreadPool.hpp"
+
+
+// How to run each script; set from the command line.
+struct RunOptions {
+  enum class Engine { VM, TREE, CLOSURE };
+  Engine engine = Engine::VM;
+  bool ast_stats = false;  // Report AST memory use on stderr before running.
+  bool optimize = true;    // Run the AST optimizer between parsing and running.
+  bool emit_cpp = false;   // Print the program as C++ rather than running it.
+  bool jit = false;        // Compile numeric while loops to machine code (VM engine only).
+  std::string cache_dir{}; // If set, reuse compiled bytecode stored here (VM engine only).
+  std::string memo_dir{};  // If set, replay whole results of earlier runs stored here.
+  uintmax_t memo_max_bytes = OutputMemo::DEFAULT_MAX_BYTES;
+  bool profile = false;    // Run on the tree walker and report where the time went.
+  std::string profile_file{};   // With profile: also write folded stacks here.
+  bool stats = false;      // Report phase times and memory use on stderr.
+
+  // Modes that look at the parsed tree or measure the run itself, so every run must really
+  // parse and execute the script rather than reuse a cached program or output.
+  bool NeedsFullRun() const { return emit_cpp || ast_stats || profile || stats; }
+};
 
-    //Parse the expression within the parenthesis
-    if_node.AddChild(ParseExpression());
-    UseToken(emplex::Lexer::ID_CLOSEPAREN);
+// Print the hot-line report to stderr and, if asked, the folded stacks to a file.
+void WriteProfile(const RunOptions & options, const MacroCalc & mc, const Profiler & profiler)
+{
+  profiler.WriteReport(mc.GetRoot(), mc.GetSource(), std::cerr);
+  if (options.profile_file.empty()) return;
+  std::ofstream file(options.profile_file);
+  profiler.WriteFolded(mc.GetRoot(), file);
+  if (!file) std::cerr << "Unable to write profile to '" << options.profile_file << "'." << std::endl;
+}
 
-    //If the if-statement has a begin scope we add a scope node
-    if (CurToken() == emplex::Lexer::ID_BEGINSCOPE) {
-      if_node.AddChild(ParseScope());
-    }
-    //Otherwise we just parse the single statement
-    else {
-      if_node.AddChild(ParseStatement());
-    }
+void RunScript(const RunOptions & options, const std::string & filename, OutputSink & out);
 
-    //If the statement has an else clause we apply the same logic as above
-    if (UseTokenIf(emplex::Lexer::ID_ELSE)) {
-      if (CurToken() == emplex::Lexer::ID_BEGINSCOPE) {
-        if_node.AddChild(ParseScope());
-      }
-      else {
-        if_node.AddChild(ParseStatement());
-      }
+// Replay the remembered output of a script with the same text, or run it and remember it.
+void RunMemoized(const RunOptions & options, const std::string & filename, OutputSink & out)
+{
+  SourceBuffer source;
+  if (!source.Load(filename)) RuntimeError("Unable to open file '" + filename + "'.");
+  const OutputMemo memo(options.memo_dir, options.memo_max_bytes);
+
+  OutputMemo::Result result;
+  if (memo.Load(source.View(), result)) out.Write(result.output);
+  else {
+    // Output streams to `out` as the script runs; a copy is kept only while it could be stored.
+    RunOptions run_options = options;
+    run_options.memo_dir.clear();
+    OutputSink capture(out, options.memo_max_bytes);
+    try {
+      RunScript(run_options, filename, capture);
+    } catch (const MacroCalcError & error) {
+      result.status = 1;
+      result.error_line = error.GetLine();
+      result.error = error.GetMessage();
+    }
+    capture.Flush();
+    if (capture.IsCopyComplete()) {
+      result.output = capture.GetCopy();
+      memo.Store(source.View(), result);
     }
-
-    return if_node; 
   }
+  if (result.status) throw MacroCalcError(result.error_line, result.error);
+}
 
-  ASTNode ParseWhile() {
-    UseToken(emplex::Lexer::ID_WHILE);
-    UseToken(emplex::Lexer::ID_OPENPAREN);
-
-    ASTNode while_node{ASTNode::WHILE};
-
-    while_node.AddChild(ParseExpression());
-
-    UseToken(emplex::Lexer::ID_CLOSEPAREN);
-
-    //Since while loops don't need to have a body or statement we can return just the parsed expression child
-    if (UseTokenIf(emplex::Lexer::ID_SEMICOLON)) return while_node;
-
-    //If it does not end in a semi-colon we check if there is a beginscope token
-    //If there is we add a beginscope node
-    if (CurToken() == emplex::Lexer::ID_BEGINSCOPE) {
-      while_node.AddChild(ParseScope());
-    }
-    //Otherwise we just parse the single statement
-    else {
-      while_node.AddChild(ParseStatement());
-    }
-
-    return while_node;
+// Run a script on the VM, compiling it only if the cache has no bytecode for its exact text.
+void RunCached(const RunOptions & options, const std::string & filename, OutputSink & out)
+{
+  SourceBuffer source;
+  if (!source.Load(filename)) RuntimeError("Unable to open file '" + filename + "'.");
+  const BytecodeCache cache(options.cache_dir);
+  const uint32_t flags = options.optimize ? BytecodeCache::FLAG_OPTIMIZED : 0;
+
+  Bytecode bytecode;
+  if (!cache.Load(source.View(), flags, bytecode)) {
+    const std::string text(source.View());   // MacroCalc takes the buffer; keep the text to hash
+    MacroCalc mc(std::move(source), out);
+    if (options.optimize) mc.Optimize();
+    bytecode = mc.CompileBytecode();
+    cache.Store(text, flags, bytecode);
   }
+  VM vm;
+  vm.Run(bytecode, out);
+}
 
-  ASTNode ParseExpression() {
-    ASTNode expressionNode =  ParseExpressionAssign();//ASTNode{ASTNode::EXPR};
-    /*while (token_id < tokens.size())
-    {
-      auto rhs = ParseExpressionAssign();
-      expressionNode.AddChild(rhs);
-    }*/
-    //std::cout << "debug tree printing: " << std::endl;
-    //DebugASTCheck(expressionNode, 0); //Remove when printing is ready
-    //std::cout << "_________" << std::endl;
-    return expressionNode;
+// Run a parsed script on the engine the options select.  `stats`, if given, receives counts
+// the engine keeps while running.
+void RunParsed(const RunOptions & options, MacroCalc & mc, RunStats * stats = nullptr)
+{
+  if (options.profile) {
+    Profiler profiler;
+    try {
+      mc.RunProfiled(profiler);
+    } catch (const MacroCalcError &) {
+      WriteProfile(options, mc, profiler);
+      throw;
+    }
+    WriteProfile(options, mc, profiler);
+    return;
   }
-
-  void DebugASTCheck(ASTNode test_node, int number)
-  {
-    //Should be able to display the tree when called
-
-    auto children = test_node.GetChildren();
-    int num2 = number + 1;
-
-    for (int i = 0; i < number; i++)
-    {
-      std::cout << " . ";
-    }
-    std::cout << test_node.GetStrValue() << std::endl;
-    for (int i = 0; i < (int)children.size(); i++)
-    {
-      DebugASTCheck(children.at(i), num2);
-    }
+  switch (options.engine) {
+  case RunOptions::Engine::VM: mc.RunVM(options.jit, stats); break;
+  case RunOptions::Engine::TREE: mc.Run(); break;
+  case RunOptions::Engine::CLOSURE: mc.RunClosures(); break;
   }
+}
 
-ASTNode ParseExpressionValue() {
-    // Check for unary minus (negative number)
-    /*bool isNegative = false;
-    if (CurToken().lexeme == "-") {
-      isNegative = true;
-      UseToken(); // Consume the '-'
-    }*/
-
-    // Get the current token to determine if it's an identifier or a number
-    auto old_node = CurToken();
-    ASTNode cur_node;
-    
-    if (old_node.lexeme == "(")
-    {
-      cur_node = ASTNode{ASTNode::PARENTH};
-      UseToken(emplex::Lexer::ID_OPENPAREN);
-      //Parse the expression within the parenthesis
-      cur_node.AddChild(ParseExpression());
-      UseToken(emplex::Lexer::ID_CLOSEPAREN);
-      cur_node.SetStrValue("()");
-      old_node = CurToken();
-    }
-    if (old_node.lexeme == "!" || old_node.lexeme == "-")
-    {
-      cur_node = ASTNode{ASTNode::MODIFIER};
-      UseToken();
-      cur_node.SetStrValue(old_node.lexeme);
-      cur_node.AddChild(ParseExpressionValue());
-    }
-    else if (old_node.id == emplex::Lexer::ID_IDENTIFIER) {
-      // The token is an identifier, so treat it as a VARIABLE node
-      cur_node = ASTNode{ASTNode::VARIABLE};
-      UseToken();  // Consume the identifier token
-
-      // Set the name of the variable in the AST node
-      cur_node.SetStrValue(old_node.lexeme);
-
-      // Check if the variable is declared in the symbol table
-      if (!symbols.HasVar(old_node.lexeme)) {
-        // Throw an error if the variable is undeclared (hopefully)
-        Error(old_node.line_id, "Undeclared variable '", old_node.lexeme, "' used in expression.");
-      }
-      
-      // Store the variable's ID for further reference if needed?
-      cur_node.SetVarID(symbols.GetVarID(old_node.lexeme));
-    } else if (old_node.id == emplex::Lexer::ID_INT || old_node.id == emplex::Lexer::ID_FLOAT) {
-      // The token is a numeric literal, so treat it as a NUMBER node
-      cur_node = ASTNode{ASTNode::NUMBER};
-      UseToken();  // Consume the number token
-
-      // Parse the lexeme as a double, applying the negative sign if necessary
-      double value = std::stod(old_node.lexeme);
-      cur_node.SetValue(value);
-    } 
-    else if (old_node.lexeme == ")")
-    {
-
-    }
-    else if (old_node.id == emplex::Lexer::ID_MATHOP)
-    {
-
-    }
-    else if (old_node.id == emplex::Lexer::ID_ID_EXPONENTIAL)
-    {
-
-    }
-    else if (old_node.id == emplex::Lexer::ID_COMPAREOP)
-    {
-
-    }
-    else {
-      // If the token is neither an identifier nor a number, it's an error
-      Error(old_node.line_id, "Expected a variable or number but found '", old_node.lexeme, "'.");
-    }
-
-    return cur_node;  // Return the constructed node
+// Parse, optimize and run one script, sending its output to `out`.  Errors throw MacroCalcError.
+void RunScript(const RunOptions & options, const std::string & filename, OutputSink & out)
+{
+  if (!options.memo_dir.empty() && !options.NeedsFullRun()) {
+    RunMemoized(options, filename, out);
+    return;
   }
-
-  ASTNode ParseExpressionExponentiate() {
-    //This Needs some fixing
-    
-    ASTNode lhs = ParseExpressionValue();
-    //Right
-    if (CurToken().lexeme == "**")
-    {
-      int token = UseToken();
-      ASTNode rhs = ParseExpressionExponentiate(); // Recurse down the right
-      ASTNode resultNode{ASTNode::MATH_OP, lhs, rhs};
-      resultNode.SetValue(token);  // Optional, depending on how SetValue is used in your code
-      resultNode.SetStrValue("**");
-      
-      return resultNode;
-      //DebugPrint("Exponential");
-    }
-    return lhs;
+  // JIT code cannot be cached, and the other engines need the parsed tree.
+  if (!options.cache_dir.empty() && options.engine == RunOptions::Engine::VM && !options.jit
+      && !options.NeedsFullRun()) {
+    RunCached(options, filename, out);
+    return;
   }
 
-  ASTNode ParseExpressionMultDivMod() {
-    //Left
-    ASTNode lhs = ParseExpressionExponentiate();
-    while (CurToken().lexeme == "*" || CurToken().lexeme == "/" || CurToken().lexeme == "%")
-    {
-      std::string lexeme_old = CurToken().lexeme;
-      int token = UseToken();
-      ASTNode rhs = ParseExpressionExponentiate();
-      lhs = ASTNode{ASTNode::MATH_OP, lhs, rhs};
-      lhs.SetValue(token);
-      lhs.SetStrValue(lexeme_old);
-      //DebugPrint(lexeme_old);
-    }
-    return lhs;
+  MacroCalc mc(filename, out);
+  const auto optimize_start = RunStats::clock::now();
+  if (options.optimize) mc.Optimize();
+  const double optimize_ms = RunStats::MsSince(optimize_start);
+  if (options.ast_stats) mc.PrintASTStats(std::cerr);
+  if (options.emit_cpp) {
+    mc.EmitCpp(std::cout);
+    return;
   }
-
-  ASTNode ParseExpressionAddSub() {
-    //Left
-    ASTNode lhs = ParseExpressionMultDivMod();
-    while (CurToken().lexeme == "+" || CurToken().lexeme == "-")
-    {
-      std::string lexeme_old = CurToken().lexeme;
-      int token = UseToken();
-      
-      ASTNode rhs = ParseExpressionMultDivMod();
-      lhs = ASTNode{ASTNode::MATH_OP, lhs, rhs};
-      lhs.SetValue(token);
-      lhs.SetStrValue(lexeme_old);
-      //DebugPrint(lexeme_old);
-    }
-    return lhs;
+  if (!options.stats) {
+    RunParsed(options, mc);
+    return;
   }
 
-  ASTNode ParseExpressionCompare() {
-    //This might need some fixing
-    //None
-    ASTNode lhs = ParseExpressionAddSub();
-    while (CurToken().lexeme == ">" || CurToken().lexeme == "<" || CurToken().lexeme == ">=" || CurToken().lexeme == "<=") {
-      std::string lexeme_old = CurToken().lexeme;
-      int token = UseToken();
-      ASTNode rhs = ParseExpressionAddSub();
-
-      if (CurToken().lexeme == ">" || CurToken().lexeme == "<" || CurToken().lexeme == ">=" || CurToken().lexeme == "<=") {
-        Error(0, "Chaining of non-associative comparison operators is not allowed.");
-      }
-
-      lhs = ASTNode{ASTNode::COMP_OP, lhs, rhs};
-      lhs.SetValue(token);
-      lhs.SetStrValue(lexeme_old);
-      //DebugPrint(lexeme_old);
-    }
-    return lhs;
+  // Sizes are taken before running, since the VM releases the tree.
+  RunStats stats = mc.GetStats();
+  stats.optimize_ms = optimize_ms;
+  const size_t output_start = out.GetBytesWritten();
+  const auto run_start = RunStats::clock::now();
+  auto report = [&]() {
+    stats.run_ms = RunStats::MsSince(run_start);
+    stats.output_bytes = out.GetBytesWritten() - output_start;
+    stats.Write(std::cerr);
+  };
+  try {
+    RunParsed(options, mc, &stats);
+  } catch (const MacroCalcError &) {
+    report();
+    throw;
   }
-  
-  ASTNode ParseExpressionEquality() {
-    //This may need some fixing
-    //None
-    ASTNode lhs = ParseExpressionCompare();
-    while (CurToken().lexeme == "!=" || CurToken().lexeme == "==") {
-      std::string lexeme_old = CurToken().lexeme;
-      int token = UseToken();
-      ASTNode rhs = ParseExpressionCompare();
-
-      if (CurToken().lexeme == "!=" || CurToken().lexeme == "==") {
-        Error(0, "Chaining of equality operators is not allowed.");
-      }
+  report();
+}
 
-      lhs = ASTNode{ASTNode::COMP_OP, lhs, rhs};
-      lhs.SetValue(token);
-      lhs.SetStrValue(lexeme_old);
-      //DebugPrint(lexeme_old);
-    }
-    return lhs;
-  }
+// Parse a flag's numeric value; false unless the whole of `text` is a non-negative number.
+template <typename T>
+bool ParseCount(std::string_view text, T & value)
+{
+  const char * end = text.data() + text.size();
+  const auto [ptr, error] = std::from_chars(text.data(), end, value);
+  return error == std::errc{} && ptr == end;
+}
 
-  ASTNode ParseExpressionAnd() {
-    //This might need some fixing
-    //Left
-    ASTNode lhs = ParseExpressionEquality();
-    if (CurToken().lexeme == "&&") {
-      int token = UseToken();
-      ASTNode rhs = ParseExpressionEquality();
-      lhs = ASTNode{ASTNode::LOGICAL_OP, lhs, rhs};
-      lhs.SetValue(token);
-      lhs.SetStrValue("&&");
-      //DebugPrint("left and");
-    }
-    return lhs;
+// Read a batch manifest: one script per line; blank lines and lines starting with '#' are skipped.
+std::vector<std::string> ReadManifest(const std::string & filename)
+{
+  std::ifstream file(filename);
+  if (file.fail()) {
+    std::cout << "ERROR: Unable to open manifest '" << filename << "'." << std::endl;
+    exit(1);
   }
-
-  ASTNode ParseExpressionOr() {
-    //Left
-    ASTNode lhs = ParseExpressionAnd();
-
-    if (CurToken().lexeme == "||") {
-      int token = UseToken();
-      ASTNode rhs = ParseExpressionAnd();
-      lhs = ASTNode{ASTNode::LOGICAL_OP, lhs, rhs};
-      lhs.SetValue(token);
-      lhs.SetStrValue("||");
-      //DebugPrint("left or");
-    }
-    return lhs;
+  std::vector<std::string> scripts;
+  std::string line;
+  while (std::getline(file, line)) {
+    const size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#') continue;
+    const size_t end = line.find_last_not_of(" \t\r");
+    scripts.push_back(line.substr(start, end - start + 1));
   }
+  return scripts;
+}
 
-  ASTNode ParseExpressionAssign() {
-    //Right
-    ASTNode lhs = ParseExpressionOr();
-    if (CurToken().lexeme == "=")
-    {      
-      int token = UseToken();
-      ASTNode rhs = ParseExpressionOr();  // Right associative.
-      //DebugPrint("right assign");
-      lhs = ASTNode(ASTNode::ASSIGN, lhs, rhs);
-      lhs.SetValue(token); 
-      lhs.SetStrValue("=");
-      //return ;
+/**
+ * Run every script concurrently, each with its own MacroCalc (and so its own SymbolTable) and
+ * its own output buffer.  Results are reported in the order the scripts were given:
+ *   === <script>: exit <status> ===
+ * followed by the script's output and, if it failed, its error message.
+ * Returns 0 if every script succeeded, 1 otherwise.
+ */
+int RunBatch(const RunOptions & options, const std::vector<std::string> & scripts, size_t jobs)
+{
+  struct Result {
+    int status{0};
+    std::string output{};
+    std::string error{};
+  };
+  std::vector<Result> results(scripts.size());
+
+  WorkStealingPool pool(jobs);
+  pool.Run(scripts.size(), [&](size_t id) {
+    Result & result = results[id];
+    OutputSink sink;
+    try {
+      RunScript(options, scripts[id], sink);
+    } catch (const std::exception & error) {   // MacroCalcError, or e.g. std::bad_alloc
+      result.status = 1;
+      result.error = error.what();
+    }
+    result.output = sink.GetBuffer();
+  });
+
+  OutputSink & out = OutputSink::Stdout();
+  size_t failed = 0;
+  for (size_t id = 0; id < scripts.size(); ++id) {
+    const Result & result = results[id];
+    out.Write("=== ");
+    out.Write(scripts[id]);
+    out.Write(result.status ? ": exit 1 ===\n" : ": exit 0 ===\n");
+    out.Write(result.output);
+    if (result.status) {
+      out.Write(result.error);
+      out.Write('\n');
+      ++failed;
     }
-    return lhs;
-  }
-
-
-  void DebugTokenCheck()
-  {
-    //DebugPrint(CurToken().lexeme);
   }
-  void DebugPrint(std::string type)
-  {
-    std::cout << type << std::endl;
-  }
-
-  double Run(const ASTNode& node) {
-    switch (node.GetType()) {
-      case ASTNode::SCOPE: {
-        for (auto & child : node.GetChildren()) {
-          Run(child);
-        }
-      }
-
-      // Return numeric values directly
-      case ASTNode::NUMBER: {
-        return node.GetValue();
-      }
-
-      case ASTNode::PARENTH: {
-        return Run(node.GetChild(0));
-      }
-
-      // Retrieve and return the value of a var from the symbol table
-      case ASTNode::VARIABLE: {
-        const size_t var_id = node.GetVarID();
-        auto test = symbols.VarValue(var_id).value;
-        return symbols.VarValue(var_id).value;
-      }
-
-      // Handle variable declarations by adding to symbol table
-      case ASTNode::VAR: {
-        const std::string &name = node.GetStrValue();
-        symbols.AddVar(name, 0.0);  // Default initialization
-        return 0.0;
-      }
-
-      // Assign the result of an EXPR to a variable
-      case ASTNode::ASSIGN: {
-        double rhs_value = Run(node.GetChild(1)); // Get RHS
-        const ASTNode& lhs = node.GetChild(0);
-        symbols.SetVarValue(lhs.GetVarID(), rhs_value);
-        return rhs_value;
-      }
-
-      // Handle both Strings and expressions in print (EG) 
-      // I need to test this to see if it makes sense.
-      case ASTNode::PRINT: {
-        // Loop through all the children of the node.
-        // A PRINT node can have multiple children, representing either strings or expressions.
-        for (const auto &child : node.GetChildren()) {
-            
-           if (child.GetType() == ASTNode::STRING) {
-            std::cout << child.GetStrValue();
-           } 
-           else if (child.GetType() == ASTNode::VARIABLE) {
-            const size_t var_id = child.GetVarID();
-            std::cout << symbols.VarValue(var_id).value;
-           }
-           else {
-            std::cout << Run(child);
-           }
-         }
-    
-        // After printing all children, newline
-        std::cout << std::endl;
-        return 0.0;
-      }
-
-      case ASTNode::IF: {
-        if (Run(node.GetChild(0)) != 0.0) {
-          return Run(node.GetChild(1)); // Run "IF" branch
-        } else if (node.GetChildren().size() > 2) {
-          return Run(node.GetChild(2)); // Run "Else" branch
-        }
-        return 0.0;
-      }
-
-      // Run while loop with repeated checks on condition
-      case ASTNode::WHILE: {
-        while (Run(node.GetChild(0)) != 0.0) { // Check condition 
-          Run(node.GetChild(1)); // Execute body
-        }
-        return 0.0;
-      }
-
-      case ASTNode::LOGICAL_OP: {
-        // Only grab lhs incase we short-circuit
-        const double lhs = Run(node.GetChild(0));
-        
-        if (node.GetStrValue() == "&&") {
-          if (lhs == 0.0) return 0.0;  // Short-circuit if lhs is false
-          return Run(node.GetChild(1)) != 0.0 ? 1.0 : 0.0;
-        } else if (node.GetStrValue() == "||") {
-          if (lhs != 0.0) return 1.0;  // Short-circuit if lhs is true
-          return Run(node.GetChild(1)) != 0.0 ? 1.0 : 0.0;
-        }
-
-        Error(0, "Unknown logical operator '", node.GetStrValue(), "'.");
-        return 0.0;
-      }
-
-
-      case ASTNode::MATH_OP: {
-        // Evaluate left and right sub-expressions first (recursion)
-        double lhs_value = Run(node.GetChild(0));
-        double rhs_value = Run(node.GetChild(1));
-        // Get the OP
-        const std::string &op = node.GetStrValue();
-        // Perform the operation based on the operator string
-          if (op == "+") return lhs_value + rhs_value;
-          else if (op == "-") return lhs_value - rhs_value;
-          else if (op == "*") return lhs_value * rhs_value;
-          else if (op == "/") {
-            if (rhs_value == 0) {
-                std::cerr << "ERROR: Division by zero." << std::endl;
-                exit(1);
-            }
-            return lhs_value / rhs_value;
-          }
-          else if (op == "%") {
-            if (rhs_value == 0) {
-                std::cerr << "ERROR: Modulus by zero." << std::endl;
-                exit(1);
-            }
-            return std::fmod(lhs_value, rhs_value);
-          }
-          else if (op == "**") return std::pow(lhs_value, rhs_value);
-          else {
-            std::cerr << "ERROR: Unknown operator '" << op << "'." << std::endl;
-            exit(1);
-          }
-        }
-
-      case ASTNode::COMP_OP: {
-        // Evaluate left and right sub-expressions first (recursion)
-        double lhs_value = Run(node.GetChild(0));
-        double rhs_value = Run(node.GetChild(1));
-        // Get the op
-        const std::string &op = node.GetStrValue();
-        // Run T/F based on lhs and rhs, return 1.0 (T) or 0.0 (F)
-        if (op == "<") return lhs_value < rhs_value ? 1.0 : 0.0;
-        else if (op == "<=") return lhs_value <= rhs_value ? 1.0 : 0.0;
-        else if (op == ">") return lhs_value > rhs_value ? 1.0 : 0.0;
-        else if (op == ">=") return lhs_value >= rhs_value ? 1.0 : 0.0;
-        else if (op == "==") return lhs_value == rhs_value ? 1.0 : 0.0;
-        else if (op == "!=") return lhs_value != rhs_value ? 1.0 : 0.0;
-        else {
-          std::cerr << "ERROR: Unknown operator '" << op << "'." << std::endl;
-          exit(1);
-        }
-      }
-
-      case ASTNode::MODIFIER: {
-        double child_val = Run(node.GetChild(0));
-
-        const std::string &op = node.GetStrValue();
-
-        if (op == "-") return child_val * -1;
-        else if (op == "!") return child_val == 0.0 ? 1.0 : 0.0;
-        else {
-          std::cerr << "ERROR: Unknown modifier '" << op << "'." << std::endl;
-          exit(1);
-        }
-      }
-
-      // Shouldn't have any EMPTY
-      case ASTNode::EMPTY:
-        std::cerr << "ERROR: Detected EMPTY node" << std::endl;
+  out.Flush();
+  std::cerr << "Batch: " << scripts.size() << " scripts, " << failed << " failed, "
+            << pool.NumThreads() << " threads." << std::endl;
+  return failed ? 1 : 0;
+}
 
-      default:
-        return 0.0;
-      }
+int main(int argc, char * argv[])
+{
+  std::vector<std::string> filenames;
+  RunOptions options;
+  bool batch = false;      // Run every named script (and any manifest) on a thread pool.
+  size_t jobs = 0;         // Batch threads; 0 means one per hardware thread.
+  bool usage_error = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--engine=tree") options.engine = RunOptions::Engine::TREE;
+    else if (arg == "--engine=vm") options.engine = RunOptions::Engine::VM;
+    else if (arg == "--engine=closure") options.engine = RunOptions::Engine::CLOSURE;
+    else if (arg == "--ast-stats") options.ast_stats = true;
+    else if (arg == "--no-opt") options.optimize = false;
+    else if (arg == "--jit") options.jit = true;
+    else if (arg == "--emit-cpp") options.emit_cpp = true;
+    else if (arg.starts_with("--cache=")) options.cache_dir = arg.substr(8);
+    else if (arg.starts_with("--memo=")) options.memo_dir = arg.substr(7);
+    else if (arg.starts_with("--memo-size=")) {
+      if (!ParseCount(std::string_view(arg).substr(12), options.memo_max_bytes)) usage_error = true;
+    }
+    else if (arg == "--profile") options.profile = true;
+    else if (arg == "--stats") options.stats = true;
+    else if (arg.starts_with("--profile=")) {
+      options.profile = true;
+      options.profile_file = arg.substr(10);
+    }
+    else if (arg.starts_with("--flush-size=")) {
+      size_t flush_size = 0;
+      if (ParseCount(std::string_view(arg).substr(13), flush_size)) OutputSink::Stdout().SetFlushSize(flush_size);
+      else usage_error = true;
+    }
+    else if (arg == "--batch") batch = true;
+    else if (arg.starts_with("--jobs=")) {
+      if (!ParseCount(std::string_view(arg).substr(7), jobs)) usage_error = true;
+    }
+    else if (arg.starts_with("--manifest=")) {
+      batch = true;
+      for (auto & script : ReadManifest(arg.substr(11))) filenames.push_back(std::move(script));
+    }
+    else if (arg[0] != '-') filenames.push_back(arg);
+    else usage_error = true;  // Unknown flag: show usage.
   }
 
-  void Run() { Run(root); }
-};
-
+  // A single run takes exactly one script; a batch takes any number but cannot emit or report.
+  if (!batch && filenames.size() != 1) usage_error = true;
+  if (batch && (filenames.empty() || options.emit_cpp || options.ast_stats || options.profile || options.stats)) usage_error = true;
 
-int main(int argc, char * argv[])
-{
-  if (argc != 2) {
-    std::cout << "Format: " << argv[0] << " [filename]" << std::endl;
+  if (usage_error) {
+    std::cout << "Format: " << argv[0] << " [--engine=vm|tree|closure] [--no-opt] [--jit] [--emit-cpp] [--ast-stats] [--stats] [--cache=DIR] [--memo=DIR [--memo-size=BYTES]] [--profile[=FOLDED_FILE]] [--flush-size=BYTES] [filename]\n"
+              << "   or: " << argv[0] << " --batch [--jobs=N] [--manifest=FILE] [engine options] [filenames...]" << std::endl;
     exit(1);
   }
 
-  std::string filename = argv[1];
-  
+  if (batch) return RunBatch(options, filenames, jobs);
+
+  const std::string & filename = filenames[0];
   std::ifstream in_file(filename);              // Load the input file
   if (in_file.fail()) {
     std::cout << "ERROR: Unable to open file '" << filename << "'." << std::endl;
     exit(1);
   }
 
-  MacroCalc mc(argv[1]);
-  mc.Run();
-  
+  try {
+    RunScript(options, filename, OutputSink::Stdout());
+  } catch (const MacroCalcError & error) {
+    OutputSink::Stdout().Flush();   // Keep any program output that came before the error
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
 }
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define MACROCALC_HAS_RUSAGE 1
+#endif
+
+/**
+ * Where one run spent its time and memory, for --stats.
+ * Phase times are wall-clock milliseconds; sizes are bytes actually held (vector capacity,
+ * heap-allocated strings), not just element counts.
+ */
+struct RunStats
+{
+  using clock = std::chrono::steady_clock;
+
+  double read_ms{0};
+  double lex_ms{0};
+  double parse_ms{0};
+  double optimize_ms{0};
+  double run_ms{0};         // Includes lowering to bytecode or closures for those engines
+
+  size_t source_bytes{0};
+  size_t num_tokens{0};
+  size_t token_bytes{0};
+  size_t ast_nodes{0};      // The tree that is run, i.e. after any optimization
+  size_t ast_bytes{0};
+  size_t num_scopes{0};     // Including the global scope
+  size_t num_vars{0};
+  size_t frame_slots{0};
+  size_t output_bytes{0};
+  std::vector<std::pair<const char *, uint64_t>> fused{};   // VM only: runs of each fused instruction kind
+
+  static double MsSince(clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+  }
+
+  // Peak resident set size of this process in bytes, or 0 if unknown.
+  static size_t PeakRSS() {
+#ifdef MACROCALC_HAS_RUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);          // Already bytes
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;   // Kilobytes on Linux
+#endif
+#else
+    return 0;
+#endif
+  }
+
+  void Write(std::ostream & os) const {
+    char row[128];
+    auto phase = [&](const char * name, double ms, const char * detail = "") {
+      std::snprintf(row, sizeof(row), "  %-9s %10.3f ms%s%s\n", name, ms, *detail ? "  " : "", detail);
+      os << row;
+    };
+    char detail[96];
+    os << "Stats:\n";
+    std::snprintf(detail, sizeof(detail), "%zu bytes of source", source_bytes);
+    phase("read", read_ms, detail);
+    std::snprintf(detail, sizeof(detail), "%zu tokens, %zu bytes", num_tokens, token_bytes);
+    phase("lex", lex_ms, detail);
+    phase("parse", parse_ms);
+    std::snprintf(detail, sizeof(detail), "%zu AST nodes, %zu bytes", ast_nodes, ast_bytes);
+    phase("optimize", optimize_ms, detail);
+    phase("run", run_ms);
+    std::snprintf(row, sizeof(row), "  symbols   %zu scopes, %zu variables, %zu frame slots\n",
+                  num_scopes, num_vars, frame_slots);
+    os << row;
+    if (!fused.empty()) {
+      os << "  fused    ";
+      for (size_t i = 0; i < fused.size(); ++i) {
+        os << (i ? ", " : " ") << fused[i].first << ' ' << fused[i].second;
+      }
+      os << '\n';
+    }
+    std::snprintf(row, sizeof(row), "  output    %zu bytes\n  peak RSS  %zu KB\n",
+                  output_bytes, PeakRSS() / 1024);
+    os << row;
+  }
+};
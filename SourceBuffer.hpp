@@ -0,0 +1,86 @@
+#pragma once
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MACROCALC_HAS_MMAP 1
+#endif
+
+/**
+ * Owns the text of a script for the whole run so that tokens can be views into it.
+ * Files are memory-mapped when possible; otherwise (or for in-memory sources) the text is
+ * held in a std::string.
+ */
+class SourceBuffer
+{
+private:
+  std::string owned{};             // Used when the source is not memory-mapped
+  const char * mapped{nullptr};    // Start of the mapping, if any
+  size_t mapped_size{0};
+
+  void Release() {
+#ifdef MACROCALC_HAS_MMAP
+    if (mapped) munmap(const_cast<char *>(mapped), mapped_size);
+#endif
+    mapped = nullptr;
+    mapped_size = 0;
+  }
+
+public:
+  SourceBuffer() = default;
+  explicit SourceBuffer(std::string text) : owned(std::move(text)) { }
+  SourceBuffer(const SourceBuffer &) = delete;
+  SourceBuffer(SourceBuffer && in) noexcept
+    : owned(std::move(in.owned)), mapped(std::exchange(in.mapped, nullptr))
+    , mapped_size(std::exchange(in.mapped_size, 0)) { }
+  SourceBuffer & operator=(const SourceBuffer &) = delete;
+  SourceBuffer & operator=(SourceBuffer && in) noexcept {
+    if (this != &in) {
+      Release();
+      owned = std::move(in.owned);
+      mapped = std::exchange(in.mapped, nullptr);
+      mapped_size = std::exchange(in.mapped_size, 0);
+    }
+    return *this;
+  }
+  ~SourceBuffer() { Release(); }
+
+  // Load a file; returns false if it cannot be opened.
+  bool Load(const std::string & filename) {
+    Release();
+    owned.clear();
+#ifdef MACROCALC_HAS_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      void * addr = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        mapped = static_cast<const char *>(addr);
+        mapped_size = static_cast<size_t>(info.st_size);
+        close(fd);
+        return true;
+      }
+    }
+    close(fd);
+#endif
+    // Fall back to reading the whole file (also covers empty files and pipes).
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    owned.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+  }
+
+  bool IsMapped() const { return mapped != nullptr; }
+  std::string_view View() const {
+    return mapped ? std::string_view(mapped, mapped_size) : std::string_view(owned);
+  }
+};
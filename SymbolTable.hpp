@@ -1,12 +1,13 @@
 #pragma once
 
 #include <assert.h>
+#include <sstream>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
-#include <stdexcept>
 
 #include "lexer.hpp"
+#include "MacroCalcError.hpp"
 
 // Using
 using std::string;
@@ -18,13 +19,12 @@ using std::endl;
 *  Example use: Error(17, "Invalid value of x; x = ", x, ".");
 */
 template <typename... Ts>
-void Error(size_t line_num, Ts... message) 
+[[noreturn]] void Error(size_t line_num, Ts... message) 
 {
-  std::cerr << "ERROR (Line " << line_num << "): ";
-  (std::cerr << ... << message);
-  std::cerr << endl;
-  // exit with non-zero 
-  exit(1);
+  std::ostringstream text;
+  (text << ... << message);
+  // Thrown rather than exiting, so one script's error cannot end a whole batch
+  throw MacroCalcError(line_num, text.str());
 }
 
 /** 
@@ -33,7 +33,13 @@ void Error(size_t line_num, Ts... message)
 *  Example use: Error(tokens[token_id], "Invalid value of y; y = ", y, ".");
 */
 template <typename... Ts>
-void Error(emplex::Token token, Ts... message) 
+[[noreturn]] void Error(emplex::Token token, Ts... message) 
+{
+  Error(token.line_id, message...);
+}
+
+template <typename... Ts>
+[[noreturn]] void Error(const emplex::TokenView & token, Ts... message) 
 {
   Error(token.line_id, message...);
 }
@@ -41,83 +47,113 @@ void Error(emplex::Token token, Ts... message)
 class SymbolTable {
 private:
   // CODE TO STORE SCOPES AND VARIABLES HERE.
-      // Structure to store variable information (EG)
+      // Debug information for each declared variable (EG)
+      // Runtime values do not live here; they live in a dense frame indexed by slot.
     struct VarData {
-        std::string name;
-        double value;
+        std::string_view name;  // View into the source text
         size_t line_num;  // Line number for error reporting
+        size_t slot;      // Index of this variable's value in the runtime frame
+        size_t depth;     // Scope depth of the declaration (0 is global)
+        size_t shadowed;  // Binding this declaration hides, restored when its scope is popped
 
-        VarData(std::string name, size_t line_num)
-      : name(name), line_num(line_num) { }
+        VarData(std::string_view name, size_t line_num, size_t slot, size_t depth, size_t shadowed)
+      : name(name), line_num(line_num), slot(slot), depth(depth), shadowed(shadowed) { }
     };
-    // Stack of scopes, each scope is a map from variable name to VarData
-    //std::vector<std::unordered_map<std::string, VarData>> scopes;
 
-    //Vector of all variables in program
+    //Vector of all variables in program (the debug table)
     std::vector<VarData> var_info;
 
-    //Stack of scopes with each scope being a map from variable name to it's index in var_info
-    using scope_t = std::unordered_map<std::string, size_t>;
-    std::vector<scope_t> scopes{1};
-  
-  // HINT: YOU CAN CONVERT EACH VARIABLE NAME TO A UNIQUE ID TO CLEANLY DEAL
-  //       WITH SHADOWING AND LOOKING UP VARIABLES LATER.
+    // Innermost visible variable for each interned name ID (NO_ID if none).  Instead of a map
+    // per scope, declarations overwrite the binding and record the name in an undo log;
+    // popping a scope walks its part of the log and restores the shadowed bindings.
+    std::vector<size_t> bindings;
+    std::vector<uint32_t> undo_log;
+
+    // Frame slots are handed out like a stack: a scope's slots are released when it is popped,
+    // so sibling scopes that are never live together share slots.
+    size_t next_slot{0};
+    size_t frame_size{0};                 // High-water mark of next_slot
+
+    // Where each open scope starts in the undo log and in the frame.
+    struct ScopeMark {
+      size_t undo_start;
+      size_t slot_start;
+    };
+    std::vector<ScopeMark> scope_marks;
+    size_t num_scopes{1};                 // Scopes ever opened, counting the global one
 
 public:
 
   static constexpr size_t NO_ID = static_cast<size_t>(-1);
 
   size_t GetNumVars() const { return var_info.size(); }
+  size_t GetNumScopes() const { return num_scopes; }
 
-  //Returns the variable ID of the innermost scope
-  //Returns -1 if no variable was found
-  size_t GetVarID(std::string name) const {
-    for (auto it = scopes.rbegin();
-         it != scopes.rend();
-         ++it)
-    {
-      if (it->count(name)) return it->find(name)->second;
-    }
+  // Number of value slots the runtime frame needs
+  size_t GetFrameSize() const { return frame_size; }
 
-    return NO_ID;
+  // Grow the frame to `size` slots, for values an optimization pass keeps beyond the variables.
+  void ReserveSlots(size_t size) {
+    if (size > frame_size) frame_size = size;
+  }
+
+  // Size the binding table for the names seen by the lexer, so declarations never grow it.
+  void Reserve(size_t num_names) {
+    if (num_names > bindings.size()) bindings.resize(num_names, NO_ID);
+  }
+
+  //Returns the variable ID visible for an interned name in the innermost scope
+  //Returns NO_ID if no variable was found
+  size_t GetVarID(uint32_t name_id) const {
+    return name_id < bindings.size() ? bindings[name_id] : NO_ID;
   }
 
   //Checks if a variable exists in any scope and returns true or false
-  bool HasVar(std::string name) const {
-    return (GetVarID(name) != NO_ID);
+  bool HasVar(uint32_t name_id) const {
+    return (GetVarID(name_id) != NO_ID);
   }
 
-  // Adds a variable to var_info vector and sets it in the scope (SP)
-  size_t AddVar(std::string name, size_t line_num) {
-    auto & scope = scopes.back();
-    if (scope.count(name)) {
+  // Adds a variable to var_info vector and binds its name in the current scope (SP)
+  size_t AddVar(uint32_t name_id, std::string_view name, size_t line_num) {
+    Reserve(static_cast<size_t>(name_id) + 1);
+    const size_t shadowed = bindings[name_id];
+    if (shadowed != NO_ID && var_info[shadowed].depth == scope_marks.size()) {
       Error(line_num, "Redeclaration of variable '", name, "'.");
     }
     size_t var_id = var_info.size();
-    var_info.emplace_back(name, line_num);
-    scope[name] = var_id;
+    var_info.emplace_back(name, line_num, next_slot++, scope_marks.size(), shadowed);
+    if (next_slot > frame_size) frame_size = next_slot;
+    bindings[name_id] = var_id;
+    undo_log.push_back(name_id);
     return var_id;
   }
 
-  //Returns a VarData struct using it's id(index) in the var_info vector
-  VarData & VarValue(size_t id) {
+  //Returns the debug info for a variable using it's id(index) in the var_info vector
+  const VarData & VarInfo(size_t id) const {
     assert(id < var_info.size());
     return var_info[id];
   }
 
-  void SetVarValue(size_t id, double val) {
-    var_info[id].value = val;
-  }
+  // Frame slot holding a variable's value at runtime
+  size_t GetSlot(size_t id) const { return VarInfo(id).slot; }
 
   // Push a new scope onto the stack (EG)
   void PushScope() {
-    scopes.emplace_back();
+    scope_marks.push_back({undo_log.size(), next_slot});
+    ++num_scopes;
   }
 
-  // Pop the top scope off the stack (EG)
+  // Pop the top scope off the stack (EG); its slots become free for the next sibling scope
   void PopScope() {
-    assert(scopes.size() > 1);
-    scopes.pop_back();
+    assert(scope_marks.size());
+    const ScopeMark mark = scope_marks.back();
+    scope_marks.pop_back();
+    while (undo_log.size() > mark.undo_start) {
+      size_t & binding = bindings[undo_log.back()];
+      binding = var_info[binding].shadowed;
+      undo_log.pop_back();
+    }
+    next_slot = mark.slot_start;
   }
 
 
@@ -143,32 +179,8 @@ public:
    * Check if a variable exists only in the current scope (EG)
    * @return True if var is found. 
    */
-  bool HasVarInCurrentScope(const std::string &name) const {
-      if (scopes.empty()) return false;
-      return scopes.back().count(name) > 0;
-  }
-
-  // Get the value of a variable by searching from top to bottom scopes (EG)
-  double GetValue(const std::string &name) const {
-    assert(HasVar(name));
-    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-      auto varIt = it->find(name);
-      if (varIt != it->end()) {
-        return var_info[varIt->second].value;
-      }
-    }
-    throw std::runtime_error("ERROR: Undefined variable '" + name + "'.");
-  }
-
-  // Set the value of a variable in the top-most scope where it exists (EG)
-  void SetValue(const std::string &name, double value) {
-    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-      auto varIt = it->find(name);
-      if (varIt != it->end()) {
-        var_info[varIt->second].value = value;
-        return;
-      }
-    }
-    throw std::runtime_error("ERROR: Cannot assign to undeclared variable '" + name + "'.");
+  bool HasVarInCurrentScope(uint32_t name_id) const {
+      const size_t var_id = GetVarID(name_id);
+      return var_id != NO_ID && var_info[var_id].depth == scope_marks.size();
   }
 };
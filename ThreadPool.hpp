@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing thread pool for a fixed batch of independent tasks.
+ * Tasks are numbered 0..n-1 and dealt out to per-worker queues in contiguous blocks.  A worker
+ * takes tasks from the back of its own queue and, once that is empty, steals from the front of
+ * the others', so a few slow tasks do not leave the remaining threads idle.  No task is added
+ * after a batch starts, so a worker that finds every queue empty is done.
+ */
+class WorkStealingPool
+{
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+  };
+
+  size_t num_threads;
+  std::vector<std::unique_ptr<Queue>> queues{};
+
+  bool PopOwn(size_t worker, size_t & task) {
+    Queue & queue = *queues[worker];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) return false;
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool Steal(size_t worker, size_t & task) {
+    for (size_t offset = 1; offset < queues.size(); ++offset) {
+      Queue & victim = *queues[(worker + offset) % queues.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (victim.tasks.empty()) continue;
+      task = victim.tasks.front();
+      victim.tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  void Work(size_t worker, const std::function<void(size_t)> & run_task) {
+    size_t task = 0;
+    while (PopOwn(worker, task) || Steal(worker, task)) run_task(task);
+  }
+
+public:
+  // A thread count of 0 means one per hardware thread.
+  explicit WorkStealingPool(size_t num_threads = 0) : num_threads(num_threads) {
+    if (this->num_threads == 0) this->num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  size_t NumThreads() const { return num_threads; }
+
+  // Run run_task(i) for every i in [0, num_tasks) and wait for all of them.
+  // run_task must not throw; catch anything task-specific inside it.
+  void Run(size_t num_tasks, const std::function<void(size_t)> & run_task) {
+    const size_t workers = std::max<size_t>(1, std::min(num_threads, num_tasks));
+    queues.clear();
+    for (size_t i = 0; i < workers; ++i) queues.push_back(std::make_unique<Queue>());
+    // Reversed within each block, so each worker starts on its lowest-numbered task.
+    for (size_t task = num_tasks; task-- > 0; ) {
+      queues[task * workers / std::max<size_t>(num_tasks, 1)]->tasks.push_back(task);
+    }
+
+    if (workers == 1) {
+      Work(0, run_task);
+      return;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (size_t i = 1; i < workers; ++i) threads.emplace_back([this, i, &run_task]() { Work(i, run_task); });
+    Work(0, run_task);
+    for (auto & thread : threads) thread.join();
+  }
+};
@@ -0,0 +1,487 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "Optimizer.hpp"
+
+/**
+ * Value numbering over straight-line regions, run after the Optimizer.
+ *
+ * A region is the list of statements in one scope (or the single statement that is the body
+ * of an if or while) up to the next if, while or nested scope.  Those are barriers: their
+ * bodies are regions of their own, and nothing is assumed across them.  Within a region every
+ * value gets a number: a literal by its bits, a variable by the value last assigned to it (so
+ * each assignment starts a new version of the slot, SSA style), and an operator by its
+ * operator and operand numbers.  On top of that numbering:
+ *  - CSE: an operator whose value was already computed is replaced by a read of a slot still
+ *    holding it.  If none does, its first computation is wrapped to store into a hidden slot.
+ *  - Copy and constant propagation: a variable read becomes a read of the slot that first
+ *    held its value, or a literal; operators on literals are folded as they appear.
+ *  - Dead-store elimination: `x = e;` is dropped if x is assigned again before it is read.
+ *    If e may fail (division or modulus by a value that may be zero) or assigns anything,
+ *    e is kept as an expression statement.
+ * Nothing is reordered and only evaluations with an identical earlier evaluation are removed,
+ * so the output and runtime errors are exactly those of MacroCalc::Run.  The right operand of
+ * && and || runs conditionally: values first computed there are forgotten after it, and
+ * variables assigned there become unknown.
+ */
+class ValueNumbering
+{
+public:
+  struct Stats {
+    size_t reused{0};           // Operators replaced by a read of an earlier result
+    size_t copies{0};           // Variable reads redirected to the first holder of the value
+    size_t constants{0};        // Variable reads and operators replaced by a literal
+    size_t dead_stores{0};      // Statement assignments removed because they are never read
+    size_t hidden_slots{0};     // Frame slots added to hold reused results
+  };
+
+private:
+  using L = emplex::Lexer;
+
+  static constexpr size_t NO_SLOT = static_cast<size_t>(-1);
+  static constexpr uint32_t NO_VALUE = static_cast<uint32_t>(-1);
+
+  // What is known about one value number.  All but the constant is only valid while `stamp`
+  // matches the current region.
+  struct Value {
+    double constant{0.0};
+    bool is_constant{false};
+    uint32_t stamp{0};
+    size_t holder{NO_SLOT};     // A slot that may still hold the value (check with Holder)
+    ASTNode * first{nullptr};   // An earlier evaluation of the value in this region
+    size_t hidden{NO_SLOT};     // Hidden slot that `first` has been wrapped to store into
+  };
+
+  // A frame slot in the current region: the value number it holds and its unread store.
+  struct Slot {
+    uint32_t stamp{0};
+    uint32_t value{NO_VALUE};
+    ASTNode * store{nullptr};
+  };
+
+  struct Key {
+    uint32_t kind;              // Node type and operator
+    uint32_t lhs;
+    uint32_t rhs;
+    bool operator==(const Key &) const = default;
+  };
+  struct KeyHash {
+    size_t operator()(const Key & key) const {
+      const uint64_t hash = (static_cast<uint64_t>(key.lhs) << 32 | key.rhs) * 0x9E3779B97F4A7C15ull;
+      return static_cast<size_t>(hash ^ (hash >> 29) ^ key.kind);
+    }
+  };
+
+  // The outcome of numbering one subtree.  A repeat is a pure operator whose value is already
+  // available; its parent replaces it, unless the parent turns out to be a repeat as well.
+  struct Result {
+    uint32_t value{NO_VALUE};
+    bool pure{true};            // Assigns nothing
+    bool repeat{false};
+    size_t holder{NO_SLOT};     // For a repeat: the slot to read, or NO_SLOT to capture `first`
+    ASTNode * first{nullptr};
+  };
+
+  struct Registration {
+    uint32_t value;
+    ASTNode * node;
+  };
+
+  struct Frame {
+    ASTNode * node;
+    size_t next_child;
+    size_t results_start;       // Results of this node's children start here
+    size_t registered_start;    // First evaluations recorded inside this node start here
+    size_t undo_start;          // For && and ||: values first seen in the right operand
+    size_t captures;            // Captures made before this node was entered
+  };
+
+  Stats stats{};
+  const size_t first_hidden;    // Hidden slots follow the slots of the program's variables
+  size_t next_hidden{0};
+
+  std::vector<Value> values;
+  std::unordered_map<Key, uint32_t, KeyHash> operators;
+  std::unordered_map<uint64_t, uint32_t> literals;
+  std::vector<Slot> slots;
+  uint32_t stamp{0};
+
+  // Scratch state, reused for every statement.
+  std::vector<Frame> frames;
+  std::vector<Result> results;
+  std::vector<Registration> registered;
+  std::vector<uint32_t> undo;   // Values first made available inside a conditional operand
+  size_t conditional{0};        // How many conditional operands enclose the current node
+  size_t captures{0};
+  std::vector<ASTNode *> dead;  // Statements whose store is never read, fixed at region end
+
+  uint32_t NewValue() {
+    values.emplace_back();
+    return static_cast<uint32_t>(values.size() - 1);
+  }
+
+  uint32_t Literal(double value) {
+    auto [it, added] = literals.try_emplace(std::bit_cast<uint64_t>(value), 0);
+    if (added) {
+      it->second = NewValue();
+      values[it->second].constant = value;
+      values[it->second].is_constant = true;
+    }
+    return it->second;
+  }
+
+  uint32_t Combine(const ASTNode & node, uint32_t lhs, uint32_t rhs) {
+    const uint32_t kind = static_cast<uint32_t>(node.GetType()) << 16 | static_cast<uint16_t>(node.GetOp());
+    auto [it, added] = operators.try_emplace(Key{kind, lhs, rhs}, 0);
+    if (added) it->second = NewValue();
+    return it->second;
+  }
+
+  bool IsActive(uint32_t value) const { return values[value].stamp == stamp; }
+
+  // Start tracking a value in this region, dropping anything known from an earlier one.
+  void Activate(uint32_t value) {
+    Value & info = values[value];
+    if (info.stamp == stamp) return;
+    info.stamp = stamp;
+    info.holder = NO_SLOT;
+    info.first = nullptr;
+    info.hidden = NO_SLOT;
+    if (conditional) undo.push_back(value);
+  }
+
+  // A fresh value number for whatever `slot` holds now.
+  uint32_t Unknown(size_t slot) {
+    const uint32_t value = NewValue();
+    Activate(value);
+    values[value].holder = slot;
+    return value;
+  }
+
+  Slot & GetSlot(size_t slot) {
+    if (slot >= slots.size()) slots.resize(slot + 1);
+    if (slots[slot].stamp != stamp) {
+      const uint32_t value = Unknown(slot);
+      slots[slot] = {stamp, value, nullptr};
+    }
+    return slots[slot];
+  }
+
+  // The slot known to hold `value` right now, or NO_SLOT.
+  size_t Holder(uint32_t value) const {
+    const size_t slot = values[value].holder;
+    if (!IsActive(value) || slot == NO_SLOT || slot >= slots.size()) return NO_SLOT;
+    return slots[slot].stamp == stamp && slots[slot].value == value ? slot : NO_SLOT;
+  }
+
+  bool IsAvailable(uint32_t value) const {
+    return IsActive(value) && (Holder(value) != NO_SLOT || values[value].first);
+  }
+
+  void NoteRead(size_t slot) { GetSlot(slot).store = nullptr; }
+
+  void Write(size_t slot, uint32_t value) {
+    Slot & state = GetSlot(slot);
+    if (conditional) {            // May or may not happen, so the slot's value is unknown
+      state.value = Unknown(slot);
+      return;
+    }
+    if (state.store) {
+      dead.push_back(state.store);
+      state.store = nullptr;
+    }
+    if (value == NO_VALUE) {
+      state.value = Unknown(slot);
+      return;
+    }
+    state.value = value;
+    if (Holder(value) == NO_SLOT) {
+      Activate(value);
+      values[value].holder = slot;
+    }
+  }
+
+  static void MakeNumber(ASTNode & node, double value) {
+    const size_t line = node.GetLine();
+    node = ASTNode{ASTNode::NUMBER, value};
+    node.SetLine(line);
+  }
+
+  static void MakeRead(ASTNode & node, size_t slot) {
+    const size_t line = node.GetLine();
+    node = ASTNode{ASTNode::VARIABLE, slot};
+    node.SetLine(line);
+  }
+
+  // Wrap the first evaluation of `value` to also store it into a hidden slot; return the slot.
+  size_t Capture(uint32_t value, ASTNode & first) {
+    Value & info = values[value];
+    if (info.first == &first && info.hidden != NO_SLOT) return info.hidden;
+    const size_t slot = first_hidden + next_hidden++;
+    if (next_hidden > stats.hidden_slots) stats.hidden_slots = next_hidden;
+    const size_t line = first.GetLine();
+    ASTNode target{ASTNode::VARIABLE, slot};
+    target.SetLine(line);
+    ASTNode expr = std::move(first);
+    first = ASTNode{ASTNode::ASSIGN, std::move(target), std::move(expr)};
+    first.SetLine(line);
+    GetSlot(slot).value = value;
+    info.hidden = slot;
+    if (Holder(value) == NO_SLOT) info.holder = slot;
+    ++captures;
+    return slot;
+  }
+
+  void Replace(ASTNode & node, const Result & result) {
+    if (!result.repeat) return;
+    MakeRead(node, result.holder != NO_SLOT ? result.holder : Capture(result.value, *result.first));
+    ++stats.reused;
+  }
+
+  Result NumberVariable(ASTNode & node) {
+    const uint32_t value = GetSlot(node.GetVarID()).value;
+    if (values[value].is_constant) {
+      MakeNumber(node, values[value].constant);
+      ++stats.constants;
+      return {value};
+    }
+    const size_t holder = Holder(value);
+    if (holder == NO_SLOT) {
+      Activate(value);
+      values[value].holder = node.GetVarID();
+    } else if (holder != node.GetVarID()) {
+      node.SetVarID(holder);
+      ++stats.copies;
+    }
+    NoteRead(node.GetVarID());
+    return {value};
+  }
+
+  // Fold an operator whose operands are all pure literals.  Returns false if it must be left
+  // for runtime (e.g., division by zero).
+  bool Fold(const ASTNode & node, const Result * children, size_t num_children, double & result) const {
+    for (size_t i = 0; i < num_children; ++i) {
+      if (!children[i].pure || !values[children[i].value].is_constant) return false;
+    }
+    const double lhs = values[children[0].value].constant;
+    const double rhs = num_children > 1 ? values[children[1].value].constant : 0.0;
+    switch (node.GetType()) {
+    case ASTNode::MODIFIER:
+      result = Optimizer::FoldUnary(node.GetOp(), lhs);
+      return true;
+    case ASTNode::LOGICAL_OP:
+      result = (node.GetOp() == L::ID_AND ? lhs != 0.0 && rhs != 0.0 : lhs != 0.0 || rhs != 0.0) ? 1.0 : 0.0;
+      return true;
+    default:
+      return Optimizer::FoldBinary(node.GetOp(), lhs, rhs, result);
+    }
+  }
+
+  Result NumberOperator(ASTNode & node, const Frame & frame) {
+    const Result * children = results.data() + frame.results_start;
+    const size_t num_children = results.size() - frame.results_start;
+    Result result;
+    for (size_t i = 0; i < num_children; ++i) {
+      result.pure = result.pure && children[i].pure;
+      if (children[i].value == NO_VALUE) {    // An operand this pass does not understand
+        for (size_t j = 0; j < num_children; ++j) Replace(node.GetChild(j), children[j]);
+        return {NO_VALUE, false};
+      }
+    }
+
+    double folded = 0.0;
+    if (Fold(node, children, num_children, folded)) {
+      MakeNumber(node, folded);
+      ++stats.constants;
+      result.value = Literal(folded);
+      return result;
+    }
+    result.value = Combine(node, children[0].value, num_children > 1 ? children[1].value : NO_VALUE);
+
+    // A repeat is not replaced yet, so that its parent can be replaced whole instead.  A
+    // subtree that captured a value for a later read must stay, so it is never a repeat.
+    if (result.pure && captures == frame.captures && IsAvailable(result.value)) {
+      result.repeat = true;
+      result.holder = Holder(result.value);
+      result.first = values[result.value].first;
+      if (result.holder != NO_SLOT) NoteRead(result.holder);
+      for (size_t i = frame.registered_start; i < registered.size(); ++i) {
+        Value & info = values[registered[i].value];
+        if (info.first == registered[i].node) info.first = nullptr;
+      }
+      registered.resize(frame.registered_start);
+      return result;
+    }
+    for (size_t i = 0; i < num_children; ++i) Replace(node.GetChild(i), children[i]);
+    if (!IsAvailable(result.value)) {
+      Activate(result.value);
+      values[result.value].first = &node;
+      registered.push_back({result.value, &node});
+    }
+    return result;
+  }
+
+  // Number a node whose children have been numbered, replacing any repeats among them.
+  Result Number(ASTNode & node, const Frame & frame) {
+    Result * children = results.data() + frame.results_start;
+    switch (node.GetType()) {
+    case ASTNode::NUMBER:
+      return {Literal(node.GetValue())};
+    case ASTNode::VARIABLE:
+      return NumberVariable(node);
+    case ASTNode::ASSIGN: {
+      Replace(node.GetChild(1), children[1]);
+      Write(node.GetChild(0).GetVarID(), children[1].value);
+      return {children[1].value, false};
+    }
+    case ASTNode::MATH_OP:
+    case ASTNode::COMP_OP:
+    case ASTNode::LOGICAL_OP:
+    case ASTNode::MODIFIER:
+      return NumberOperator(node, frame);
+    case ASTNode::PRINT:
+      for (size_t i = 0; i < results.size() - frame.results_start; ++i) Replace(node.GetChild(i), children[i]);
+      return {NO_VALUE, false};
+    case ASTNode::STRING:         // Text in a print
+      return {};
+    default:
+      return {NO_VALUE, false};
+    }
+  }
+
+  // Number one statement or condition in evaluation order, children before their parent,
+  // from an explicit stack so that expressions of any depth work.
+  void NumberTree(ASTNode & root) {
+    frames.push_back({&root, 0, results.size(), registered.size(), 0, captures});
+    while (frames.size()) {
+      Frame & frame = frames.back();
+      ASTNode & node = *frame.node;
+      if (frame.next_child < node.GetChildren().size()) {
+        const size_t i = frame.next_child++;
+        if (node.GetType() == ASTNode::ASSIGN && i == 0) {
+          results.push_back({});    // The target is written, not read
+          continue;
+        }
+        if (node.GetType() == ASTNode::LOGICAL_OP && i == 1) {
+          frame.undo_start = undo.size();
+          ++conditional;
+        }
+        frames.push_back({&node.GetChild(i), 0, results.size(), registered.size(), 0, captures});
+        continue;
+      }
+      const Frame done = frame;
+      frames.pop_back();
+      if (node.GetType() == ASTNode::LOGICAL_OP) {
+        --conditional;
+        while (undo.size() > done.undo_start) {
+          values[undo.back()].stamp = 0;
+          undo.pop_back();
+        }
+      }
+      const Result result = Number(node, done);
+      results.resize(done.results_start);
+      results.push_back(result);
+    }
+    Replace(root, results.back());
+    results.clear();
+    registered.clear();
+  }
+
+  void StartRegion() {
+    ++stamp;
+    next_hidden = 0;
+  }
+
+  static bool MayFail(const ASTNode & node) {
+    if (node.GetType() == ASTNode::MATH_OP && (node.GetOp() == L::ID_DIVIDE || node.GetOp() == L::ID_MODULUS)) {
+      const ASTNode & divisor = node.GetChild(1);
+      return divisor.GetType() != ASTNode::NUMBER || divisor.GetValue() == 0.0;
+    }
+    return false;
+  }
+
+  // Does evaluating `root` do anything besides produce a value?
+  static bool HasEffects(const ASTNode & root) {
+    std::vector<const ASTNode *> stack{&root};
+    while (stack.size()) {
+      const ASTNode & node = *stack.back();
+      stack.pop_back();
+      if (node.GetType() == ASTNode::ASSIGN || MayFail(node)) return true;
+      for (const ASTNode & child : node.GetChildren()) stack.push_back(&child);
+    }
+    return false;
+  }
+
+  // Number the statements of one region; returns true if any were removed (left EMPTY).
+  bool NumberRegion(ASTNode * statements, size_t count) {
+    StartRegion();
+    for (size_t i = 0; i < count; ++i) {
+      ASTNode & statement = statements[i];
+      switch (statement.GetType()) {
+      case ASTNode::IF:
+        NumberTree(statement.GetChild(0));
+        StartRegion();
+        break;
+      case ASTNode::WHILE:
+      case ASTNode::SCOPE:
+        StartRegion();
+        break;
+      default:
+        NumberTree(statement);
+        if (statement.GetType() == ASTNode::ASSIGN) {
+          GetSlot(statement.GetChild(0).GetVarID()).store = &statement;
+        }
+        break;
+      }
+    }
+    StartRegion();
+    const bool removed = dead.size();
+    for (ASTNode * statement : dead) {
+      if (HasEffects(statement->GetChild(1))) statement->ReplaceWithChild(1);
+      else *statement = ASTNode{};
+      ++stats.dead_stores;
+    }
+    dead.clear();
+    return removed;
+  }
+
+public:
+  explicit ValueNumbering(size_t frame_size) : first_hidden(frame_size) {}
+
+  const Stats & GetStats() const { return stats; }
+
+  // Slots the runtime frame needs, including the hidden ones added by Run.
+  size_t GetFrameSize() const { return first_hidden + stats.hidden_slots; }
+
+  // Number every region of a program in place.
+  void Run(ASTNode & root) {
+    std::vector<ASTNode *> stack{&root};
+    while (stack.size()) {
+      ASTNode & node = *stack.back();
+      stack.pop_back();
+      std::vector<ASTNode> & children = node.GetChildren();
+      switch (node.GetType()) {
+      case ASTNode::SCOPE:
+        if (NumberRegion(children.data(), children.size())) {
+          std::erase_if(children, [](const ASTNode & child) { return child.GetType() == ASTNode::EMPTY; });
+        }
+        for (ASTNode & child : children) stack.push_back(&child);
+        break;
+      case ASTNode::IF:
+      case ASTNode::WHILE:
+        for (size_t i = 1; i < children.size(); ++i) {
+          if (children[i].GetType() != ASTNode::SCOPE) NumberRegion(&children[i], 1);
+          stack.push_back(&children[i]);
+        }
+        break;
+      default:
+        break;
+      }
+    }
+  }
+};
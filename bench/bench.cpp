@@ -0,0 +1,264 @@
+// Micro and macro benchmarks for the lexer, parser and interpreter; results are printed as JSON.
+//
+// Every workload is generated here, so runs are comparable across releases:
+//   expression_chain  long arithmetic/comparison expressions, evaluated in a loop
+//   deep_scopes       scopes nested hundreds deep, each declaring a variable, re-entered in a loop
+//   print_heavy       a loop that prints a template string with several variables per iteration
+//   collatz_scaled    tests/test-36.Mc run over many start values instead of just 27
+//   primes_scaled     tests/test-37.Mc with a larger power bound, repeated
+// Each workload reports
+//   lex     emplex::Lexer::TokenizeViews throughput, in MB of source per second
+//   parse   MacroCalc::Parse throughput, in AST nodes per second
+//   run_vm / run_tree
+//           statements executed per second on the default VM and on the tree walker (Run)
+// After at least one warmup run, each phase is timed `repetitions` times.  min, median and p90 times are
+// reported, and rates are computed from the median.
+//
+// Usage: bench/bench [repetitions] [warmup] > results.json
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "MacroCalc.hpp"
+
+namespace {
+
+  using clock = std::chrono::steady_clock;
+
+  struct Workload {
+    std::string name;
+    std::string source;
+  };
+
+  std::string ExpressionChain() {
+    std::string text = "var a = 3; var b = 5; var c = 7; var x = 0; var i = 0;\n"
+                       "while (i < 400) {\n";
+    for (int line = 0; line < 100; ++line) {
+      text += "  x = a";
+      for (int term = 0; term < 24; ++term) {
+        static const char * ops[] = {" + ", " * ", " - ", " / ", " % "};
+        static const char * vars[] = {"b", "c", "(a + 1)", "(i + 1)", "2.5", "(b + i)"};   // Never 0
+        text += ops[(line + term) % 5];
+        text += vars[(line * 7 + term) % 6];
+        if (term % 5 == 4) text += (line % 2) ? " < 1000 && c" : " >= 0 || b";
+      }
+      text += ";\n  if (x != x) x = 0;\n";
+    }
+    text += "  i = i + 1;\n}\nprint(\"x = {x}\");\n";
+    return text;
+  }
+
+  std::string DeepScopes() {
+    const int depth = 400;
+    std::string text = "var v0 = 0; var total = 0; var i = 0;\nwhile (i < 200) {\n";
+    for (int d = 1; d <= depth; ++d) {
+      text += std::string(static_cast<size_t>(d), ' ') + "{ var v" + std::to_string(d) + " = v"
+            + std::to_string(d - 1) + " + 1;\n";
+    }
+    text += std::string(depth + 1, ' ') + "total = total + v" + std::to_string(depth) + ";\n";
+    for (int d = depth; d >= 1; --d) text += std::string(static_cast<size_t>(d), ' ') + "}\n";
+    text += "  i = i + 1;\n}\nprint(\"total = {total}\");\n";
+    return text;
+  }
+
+  std::string PrintHeavy() {
+    return "var i = 0; var sq = 0; var half = 0;\n"
+           "while (i < 100000) {\n"
+           "  sq = i * i;\n"
+           "  half = i / 2;\n"
+           "  print(\"Row {i}: square {sq}, half {half}, and some fixed text to copy\");\n"
+           "  i = i + 1;\n"
+           "}\n";
+  }
+
+  std::string CollatzScaled() {
+    return "var start = 1; var total = 0;\n"
+           "while (start <= 2000) {\n"
+           "  var n = start;\n"
+           "  var count = 0;\n"
+           "  print(\"Start value = {n}\");\n"
+           "  while (n != 1) {\n"
+           "    if (n % 2 == 0) {\n"
+           "      n = n / 2;\n"
+           "    } else {\n"
+           "      n = 3 * n + 1;\n"
+           "    }\n"
+           "    count = count + 1;\n"
+           "    print(\"Step {count}: {n}\");\n"
+           "  }\n"
+           "  print(\"Steps to reach 1: {count}\");\n"
+           "  total = total + count;\n"
+           "  start = start + 1;\n"
+           "}\n";
+  }
+
+  std::string PrimesScaled() {
+    return "var rep = 0;\n"
+           "while (rep < 100) {\n"
+           "var power = 1;\n"
+           "while (power <= 20) {\n"
+           "  var value = 2 ** power + 1;\n"
+           "  var is_prime = 1;\n"
+           "  var test_cap = value ** 0.5;  // Only need to test to square root\n"
+           "  var test_val = 2;\n"
+           "  while (is_prime && test_val <= test_cap) {\n"
+           "    if (value % test_val == 0) {\n"
+           "      is_prime = 0;\n"
+           "    }\n"
+           "    else test_val = test_val + 1;\n"
+           "  }\n"
+           "  if (is_prime) {\n"
+           "    print(\"{value} is PRIME.\");\n"
+           "  } else {\n"
+           "    var result = value / test_val;\n"
+           "    print(\"{value} is NOT prime ({value} / {test_val} = {result}).\");\n"
+           "  }\n"
+           "  power = power + 1;\n"
+           "}\n"
+           "rep = rep + 1;\n"
+           "}\n";
+  }
+
+  // Statements executed, counted once with the profiled walker: every node in statement
+  // position (a child of a scope, or the body or branch of an if or while) that is not a scope.
+  uint64_t CountStatements(const ASTNode & node, const Profiler & profiler) {
+    uint64_t count = 0;
+    auto statement = [&](const ASTNode & child) {
+      if (child.GetType() == ASTNode::SCOPE) return;
+      if (const Profiler::Stat * stat = profiler.Find(child)) count += stat->count;
+    };
+    switch (node.GetType()) {
+    case ASTNode::SCOPE:
+      for (const ASTNode & child : node.GetChildren()) statement(child);
+      break;
+    case ASTNode::IF:
+    case ASTNode::WHILE:
+      for (size_t i = 1; i < node.GetChildren().size(); ++i) statement(node.GetChild(i));
+      break;
+    default:
+      break;
+    }
+    for (const ASTNode & child : node.GetChildren()) count += CountStatements(child, profiler);
+    return count;
+  }
+
+  double Ms(clock::time_point start, clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  struct Timing {
+    double min_ms, median_ms, p90_ms;
+  };
+
+  // Time `run`, which returns the milliseconds it measured.  Fast phases are repeated within
+  // each sample until it takes at least MIN_SAMPLE_MS, so clock resolution does not dominate;
+  // every time reported is per call.
+  constexpr double MIN_SAMPLE_MS = 2.0;
+
+  Timing Measure(size_t warmup, size_t repetitions, const std::function<double()> & run) {
+    double first = run();
+    for (size_t i = 1; i < warmup; ++i) first = std::min(first, run());
+    const size_t calls = first >= MIN_SAMPLE_MS ? 1 : static_cast<size_t>(MIN_SAMPLE_MS / std::max(first, 1e-4)) + 1;
+    std::vector<double> times;
+    for (size_t i = 0; i < repetitions; ++i) {
+      double total = 0;
+      for (size_t call = 0; call < calls; ++call) total += run();
+      times.push_back(total / static_cast<double>(calls));
+    }
+    std::sort(times.begin(), times.end());
+    const auto at = [&](double fraction) {
+      return times[static_cast<size_t>(fraction * static_cast<double>(times.size() - 1) + 0.5)];
+    };
+    return {times.front(), at(0.5), at(0.9)};
+  }
+
+  void WritePhase(const char * name, const char * unit, double amount, const Timing & timing, bool last) {
+    std::printf("      \"%s\": {\"unit\": \"%s\", \"rate\": %.1f, \"min_ms\": %.3f, \"median_ms\": %.3f, \"p90_ms\": %.3f}%s\n",
+                name, unit, amount / (timing.median_ms / 1000.0), timing.min_ms, timing.median_ms,
+                timing.p90_ms, last ? "" : ",");
+  }
+
+}
+
+int main(int argc, char * argv[])
+{
+  const size_t repetitions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 7;
+  const size_t warmup = argc > 2 ? std::max<size_t>(1, std::strtoul(argv[2], nullptr, 10)) : 2;
+  if (repetitions == 0) {
+    std::fprintf(stderr, "Usage: %s [repetitions >= 1] [warmup]\n", argv[0]);
+    return 1;
+  }
+
+  const std::vector<Workload> workloads = {
+    {"expression_chain", ExpressionChain()},
+    {"deep_scopes", DeepScopes()},
+    {"print_heavy", PrintHeavy()},
+    {"collatz_scaled", CollatzScaled()},
+    {"primes_scaled", PrimesScaled()},
+  };
+
+  std::printf("{\n  \"format\": 1,\n  \"repetitions\": %zu,\n  \"warmup\": %zu,\n  \"workloads\": [\n",
+              repetitions, warmup);
+  for (size_t w = 0; w < workloads.size(); ++w) {
+    const Workload & workload = workloads[w];
+    std::fprintf(stderr, "Benchmarking %s...\n", workload.name.c_str());
+
+    // Sizes, and the statement count from one profiled run.
+    OutputSink discard;
+    MacroCalc counted(SourceBuffer(workload.source), discard);
+    counted.Optimize();
+    const RunStats sizes = counted.GetStats();
+    Profiler profiler;
+    counted.RunProfiled(profiler);
+    const uint64_t statements = CountStatements(counted.GetRoot(), profiler);
+
+    const Timing lex = Measure(warmup, repetitions, [&]() {
+      Interner names;
+      emplex::Lexer lexer;
+      const auto start = clock::now();
+      auto tokens = lexer.TokenizeViews(workload.source, &names);
+      return Ms(start, clock::now());
+    });
+    const Timing parse = Measure(warmup, repetitions, [&]() {
+      OutputSink out;
+      MacroCalc mc(SourceBuffer(workload.source), out);
+      return mc.GetStats().parse_ms;
+    });
+    const Timing run_vm = Measure(warmup, repetitions, [&]() {
+      OutputSink out;
+      MacroCalc mc(SourceBuffer(workload.source), out);
+      mc.Optimize();
+      const auto start = clock::now();
+      mc.RunVM();
+      return Ms(start, clock::now());
+    });
+    const Timing run_tree = Measure(warmup, repetitions, [&]() {
+      OutputSink out;
+      MacroCalc mc(SourceBuffer(workload.source), out);
+      mc.Optimize();
+      const auto start = clock::now();
+      mc.Run();
+      return Ms(start, clock::now());
+    });
+
+    // Parse throughput is per node of the tree as parsed, before optimization.
+    OutputSink unused;
+    const size_t parsed_nodes = MacroCalc(SourceBuffer(workload.source), unused).GetStats().ast_nodes;
+
+    std::printf("    {\n      \"name\": \"%s\",\n      \"source_bytes\": %zu,\n      \"tokens\": %zu,\n"
+                "      \"ast_nodes\": %zu,\n      \"statements\": %llu,\n",
+                workload.name.c_str(), sizes.source_bytes, sizes.num_tokens, parsed_nodes,
+                static_cast<unsigned long long>(statements));
+    WritePhase("lex", "MB/s", static_cast<double>(sizes.source_bytes) / 1e6, lex, false);
+    WritePhase("parse", "nodes/s", static_cast<double>(parsed_nodes), parse, false);
+    WritePhase("run_vm", "statements/s", static_cast<double>(statements), run_vm, false);
+    WritePhase("run_tree", "statements/s", static_cast<double>(statements), run_tree, true);
+    std::printf("    }%s\n", w + 1 < workloads.size() ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+  return 0;
+}
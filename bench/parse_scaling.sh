@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Parse-scaling benchmark: times Project2 on two expression-heavy workloads.
+#   chain: one long "a + a + ... + a" sum chain
+#   mixed: many statements mixing every binary and unary operator
+# If parsing is linear, the ns/term column should stay roughly flat as the term count doubles.
+#
+# Usage: bench/parse_scaling.sh [path/to/Project2] [extra Project2 flags...]
+
+PROJECT2=${1:-./Project2}
+shift
+FLAGS="$@"
+REPEATS=3
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Write a script with a single N-term addition chain.
+make_chain() {
+    local terms=$1
+    local file=$2
+    {
+        echo "var a = 1;"
+        printf "var x = a"
+        for ((i = 1; i < terms; i++)); do printf " + a"; done
+        echo ";"
+    } > "$file"
+}
+
+# Write a script of statements using every operator; each statement has 16 operands.
+make_mixed() {
+    local terms=$1
+    local file=$2
+    {
+        echo "var a = 1; var b = 2; var c = 0; var x;"
+        for ((i = 0; i < terms; i += 16)); do
+            echo "x = (a * 2 + b % 3 - a ** 2 / 4) >= b && b != a || !c;"
+            echo "x = -a + (b - c) * (a + 1) < 7 == (c <= b) && x > 0;"
+        done
+    } > "$file"
+}
+
+printf "%8s %8s %12s %10s\n" "workload" "terms" "best_us" "ns/term"
+for workload in chain mixed; do
+for terms in 10000 20000 40000; do
+    file="$WORK_DIR/$workload-$terms.Mc"
+    make_$workload $terms "$file"
+    best=0
+    for ((r = 0; r < REPEATS; r++)); do
+        start=$(date +%s%N)
+        "$PROJECT2" $FLAGS "$file" > /dev/null || exit 1
+        elapsed=$(( $(date +%s%N) - start ))
+        if [[ $best -eq 0 || $elapsed -lt $best ]]; then best=$elapsed; fi
+    done
+    printf "%8s %8d %12d %10d\n" $workload $terms $((best / 1000)) $((best / terms))
+done
+done
@@ -5,9 +5,12 @@
 #include <array>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "Interner.hpp"
+
 namespace emplex {
   // Struct to store information about a found Token
   struct Token {
@@ -16,6 +19,15 @@ namespace emplex {
     size_t line_id;                     // Line token started on
     operator int() const { return id; } // Auto-convert tokens to IDs
   };
+
+  // Token whose lexeme is a view into the source; the source must outlive the token.
+  struct TokenView {
+    int id;                             // Type ID for token
+    std::string_view lexeme;            // Sequence matched by token
+    size_t line_id;                     // Line token started on
+    uint32_t name_id{Interner::NO_NAME}; // Interned name, for identifiers
+    operator int() const { return id; } // Auto-convert tokens to IDs
+  };
   
   // Deterministic Finite Automaton (DFA) for token recognition.
   class DFA {
@@ -122,7 +134,7 @@ namespace emplex {
   
   class Lexer {
   private:
-    static constexpr int NUM_TOKENS=22;
+    static constexpr int NUM_TOKENS=37;
     static constexpr int ERROR_ID = -1;     ///< Code for unknown token ID.
   
     // -- Current State --
@@ -155,6 +167,26 @@ namespace emplex {
     static constexpr int ID_OPENPAREN = 253;        // Regex: \(
     static constexpr int ID_ENDSCOPE = 254;         // Regex: \}
     static constexpr int ID_BEGINSCOPE = 255;       // Regex: \{
+
+    // Operator IDs.  The DFA reports operators by class (MATHOP, COMPAREOP, LOGICALOP, UNARY,
+    // ID_EXPONENTIAL, or the raw '/' character); RefineOperator() maps each one to its own ID
+    // before a token is returned, so the parser can dispatch on integers alone.
+    static constexpr int ID_PLUS = 256;             // +
+    static constexpr int ID_MINUS = 257;            // -
+    static constexpr int ID_TIMES = 258;            // *
+    static constexpr int ID_DIVIDE = 259;           // /
+    static constexpr int ID_MODULUS = 260;          // %
+    static constexpr int ID_POWER = 261;            // **
+    static constexpr int ID_LESS = 262;             // <
+    static constexpr int ID_LESS_EQUAL = 263;       // <=
+    static constexpr int ID_GREATER = 264;          // >
+    static constexpr int ID_GREATER_EQUAL = 265;    // >=
+    static constexpr int ID_EQUAL = 266;            // ==
+    static constexpr int ID_NOT_EQUAL = 267;        // !=
+    static constexpr int ID_AND = 268;              // &&
+    static constexpr int ID_OR = 269;               // ||
+    static constexpr int ID_NOT = 270;              // !
+    static constexpr int MAX_ID = 270;
   
     // Return the name of a token given its ID.
     static constexpr const char * TokenName(int id) {
@@ -183,6 +215,21 @@ namespace emplex {
       case 253: return "OPENPAREN";
       case 254: return "ENDSCOPE";
       case 255: return "BEGINSCOPE";
+      case 256: return "PLUS";
+      case 257: return "MINUS";
+      case 258: return "TIMES";
+      case 259: return "DIVIDE";
+      case 260: return "MODULUS";
+      case 261: return "POWER";
+      case 262: return "LESS";
+      case 263: return "LESS_EQUAL";
+      case 264: return "GREATER";
+      case 265: return "GREATER_EQUAL";
+      case 266: return "EQUAL";
+      case 267: return "NOT_EQUAL";
+      case 268: return "AND";
+      case 269: return "OR";
+      case 270: return "NOT";
       default: return "_ASCII_";
       };
     }
@@ -198,13 +245,42 @@ namespace emplex {
       };
     }
   
+    // Map an operator class from the DFA to the specific operator's ID.
+    static constexpr int RefineOperator(int id, std::string_view lexeme) {
+      switch (id) {
+      case ID_MATHOP:
+      case ID_UNARY:
+        switch (lexeme[0]) {
+        case '+': return ID_PLUS;
+        case '-': return ID_MINUS;
+        case '*': return ID_TIMES;
+        case '%': return ID_MODULUS;
+        case '!': return ID_NOT;
+        }
+        return id;
+      case '/': return ID_DIVIDE;
+      case ID_ID_EXPONENTIAL: return ID_POWER;
+      case ID_LOGICALOP: return lexeme[0] == '&' ? ID_AND : ID_OR;
+      case ID_COMPAREOP:
+        if (lexeme.size() == 1) return lexeme[0] == '<' ? ID_LESS : ID_GREATER;
+        switch (lexeme[0]) {
+        case '<': return ID_LESS_EQUAL;
+        case '>': return ID_GREATER_EQUAL;
+        case '=': return ID_EQUAL;
+        case '!': return ID_NOT_EQUAL;
+        }
+        return id;
+      default: return id;
+      }
+    }
+
     // Return the number of token types the lexer recognizes.
     static constexpr int GetNumTokens() { return NUM_TOKENS; }
   
-    // Generate and return the next token from the input stream.
-    Token NextToken(std::string_view in) {
+    // Generate the next token as a view into the input; no lexeme is copied.
+    TokenView NextTokenView(std::string_view in) {
       // If we cannot read in, return an "EOF" token.
-      if (start_pos >= std::ssize(in)) return { 0, "", cur_line };
+      if (start_pos >= std::ssize(in)) return { 0, in.substr(in.size()), cur_line };
   
       int cur_pos = start_pos;   // Position in the input that we are actively analyzing
       int best_pos = start_pos;  // Best look-ahead we've found so far
@@ -227,7 +303,7 @@ namespace emplex {
         cur_stop = DFA::GetStop(cur_state);
         if (cur_stop > 0) { best_pos = cur_pos; best_stop = cur_stop; }
         // Look ahead to see if we are at the END OF A LINE that can finish a token.
-        if (cur_pos == in.size() || in[cur_pos] == '\n') {
+        if (cur_pos == std::ssize(in) || in[cur_pos] == '\n') {
           int eol_state = DFA::GetNext(cur_state, DFA::SYMBOL_STOP);
           int eol_stop = DFA::GetStop(eol_state);
           if (eol_stop > 0) { best_pos = cur_pos; best_stop = eol_stop; }
@@ -237,15 +313,37 @@ namespace emplex {
       // If we did not find any options, peel off just one character and use it as id.
       if (best_pos == start_pos) { best_stop=in[start_pos]; best_pos++;}
   
-      lexeme = in.substr(start_pos, best_pos-start_pos);
-      start_pos += std::ssize(lexeme);
+      const std::string_view found = in.substr(start_pos, best_pos-start_pos);
+      start_pos += std::ssize(found);
   
       // Update the line number we are on.
       const size_t out_line = cur_line;
-      cur_line += static_cast<size_t>(std::count(lexeme.begin(),lexeme.end(),'\n'));
+      cur_line += static_cast<size_t>(std::count(found.begin(),found.end(),'\n'));
   
       // Return the token we found.
-      return { best_stop, lexeme, out_line };
+      return { RefineOperator(best_stop, found), found, out_line };
+    }
+  
+    // Generate and return the next token from the input stream.
+    Token NextToken(std::string_view in) {
+      TokenView token = NextTokenView(in);
+      lexeme = token.lexeme;
+      return { token.id, lexeme, token.line_id };
+    }
+  
+    // Convert an input string into a vector of token views; `in` must outlive the tokens.
+    // If `names` is given, every identifier is interned and its token carries the name ID.
+    std::vector<TokenView> TokenizeViews(std::string_view in, Interner * names = nullptr) {
+      start_pos = 0;
+      cur_line = 1;
+      std::vector<TokenView> out_tokens;
+      out_tokens.reserve(in.size() / 8);   // Rough guess to avoid most regrowth.
+      while (TokenView token = NextTokenView(in)) {
+        if (IgnoreToken(token.id)) continue;
+        if (names && token.id == ID_IDENTIFIER) token.name_id = names->Intern(token.lexeme);
+        out_tokens.push_back(token);
+      }
+      return out_tokens;
     }
   
     // Convert an input string into a vector of tokens.
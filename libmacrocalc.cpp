@@ -0,0 +1,39 @@
+#include "libmacrocalc.hpp"
+
+#include "MacroCalc.hpp"
+
+namespace macrocalc {
+
+  static Diagnostic MakeDiagnostic(const MacroCalcError & error) {
+    Diagnostic diagnostic;
+    diagnostic.kind = error.IsRuntimeError() ? Diagnostic::RUNTIME_ERROR : Diagnostic::PARSE_ERROR;
+    diagnostic.line = error.GetLine();
+    diagnostic.message = error.GetMessage();
+    diagnostic.text = error.what();
+    return diagnostic;
+  }
+
+  Diagnostic Program::Run(OutputSink & out) const {
+    try {
+      VM vm;   // Registers are per run, so concurrent runs share nothing mutable.
+      vm.Run(*code, out);
+    } catch (const MacroCalcError & error) {
+      return MakeDiagnostic(error);
+    }
+    return {};
+  }
+
+  CompileResult Compile(std::string_view source, const CompileOptions & options) {
+    CompileResult result;
+    try {
+      OutputSink unused;   // Parsing never prints; the sink only matters when running.
+      MacroCalc mc(SourceBuffer(std::string(source)), unused);
+      if (options.optimize) mc.Optimize();
+      result.program.emplace(std::make_shared<const Bytecode>(mc.CompileBytecode(options.jit)));
+    } catch (const MacroCalcError & error) {
+      result.diagnostic = MakeDiagnostic(error);
+    }
+    return result;
+  }
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "OutputSink.hpp"
+
+class Bytecode;
+
+/**
+ * Embeddable interface to MacroCalc (libmacrocalc.a).
+ * Compile a script from memory once, then run the resulting Program as often as needed, from
+ * any number of threads, each run writing to its own OutputSink.  Nothing in the library
+ * prints, exits, or touches global state; every failure comes back as a Diagnostic.
+ */
+namespace macrocalc {
+
+  struct Diagnostic {
+    enum Kind { NONE = 0, PARSE_ERROR, RUNTIME_ERROR };
+    Kind kind{NONE};
+    size_t line{0};          // Source line for parse errors; 0 otherwise
+    std::string message{};   // e.g. "Division by zero."
+    std::string text{};      // The full line the command-line tool prints, e.g. "ERROR: Division by zero."
+
+    explicit operator bool() const { return kind != NONE; }
+  };
+
+  struct CompileOptions {
+    bool optimize = true;    // Run the AST optimizer before lowering to bytecode.
+    bool jit = false;        // Compile numeric while loops to machine code.
+  };
+
+  // A compiled script.  Cheap to copy; copies share the same read-only code.
+  class Program {
+  private:
+    std::shared_ptr<const Bytecode> code;
+
+  public:
+    explicit Program(std::shared_ptr<const Bytecode> code) : code(std::move(code)) { }
+
+    // Run from a fresh set of variables.  Output written before a runtime error stays in `out`.
+    Diagnostic Run(OutputSink & out) const;
+  };
+
+  struct CompileResult {
+    std::optional<Program> program{};   // Empty if the script did not compile
+    Diagnostic diagnostic{};
+  };
+
+  CompileResult Compile(std::string_view source, const CompileOptions & options = {});
+
+}
@@ -0,0 +1,98 @@
+// Checks the embeddable library API (libmacrocalc.hpp) without going through the command line.
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BytecodeCache.hpp"
+#include "libmacrocalc.hpp"
+
+static int failures = 0;
+
+static void Check(bool ok, const std::string & what) {
+  if (!ok) {
+    std::cout << "API test failed: " << what << std::endl;
+    ++failures;
+  }
+}
+
+int main()
+{
+  // Compile once from a string, then run twice: each run starts from fresh variables.
+  const std::string source = "var x = 0;\nwhile (x < 3) { x = x + 1; }\nprint(\"x = {x}\");\n";
+  for (bool jit : {false, true}) {
+    macrocalc::CompileResult result = macrocalc::Compile(source, {.optimize = true, .jit = jit});
+    Check(result.program.has_value() && !result.diagnostic, "valid script compiles");
+    if (!result.program) continue;
+    for (int run = 0; run < 2; ++run) {
+      OutputSink out;
+      Check(!result.program->Run(out), "valid script runs");
+      Check(out.GetBuffer() == "x = 3\n", "output of run " + std::to_string(run));
+    }
+  }
+
+  // Concurrent runs of one program each see their own output.
+  {
+    macrocalc::CompileResult result = macrocalc::Compile("var i = 0; var s = 0;\n"
+                                                         "while (i < 1000) { s = s + i; i = i + 1; }\n"
+                                                         "print(s);\n");
+    std::vector<std::string> outputs(4);
+    std::vector<std::thread> threads;
+    for (auto & output : outputs) {
+      threads.emplace_back([&result, &output]() {
+        OutputSink out;
+        result.program->Run(out);
+        output = out.GetBuffer();
+      });
+    }
+    for (auto & thread : threads) thread.join();
+    for (const auto & output : outputs) Check(output == "499500\n", "concurrent run output");
+  }
+
+  // Parse errors carry their line and are reported instead of printed.
+  {
+    macrocalc::CompileResult result = macrocalc::Compile("var a = 1;\nprint(b);\n");
+    Check(!result.program, "undeclared variable does not compile");
+    Check(result.diagnostic.kind == macrocalc::Diagnostic::PARSE_ERROR, "parse error kind");
+    Check(result.diagnostic.line == 2, "parse error line");
+    Check(result.diagnostic.text.starts_with("ERROR (Line 2): "), "parse error text");
+  }
+
+  // Runtime errors keep the output written before them.
+  {
+    macrocalc::CompileResult result = macrocalc::Compile("var z = 0;\nprint(1);\nprint(1 / z);\n");
+    Check(result.program.has_value(), "runtime-error script compiles");
+    if (result.program) {
+      OutputSink out;
+      macrocalc::Diagnostic diagnostic = result.program->Run(out);
+      Check(diagnostic.kind == macrocalc::Diagnostic::RUNTIME_ERROR, "runtime error kind");
+      Check(diagnostic.message == "Division by zero.", "runtime error message");
+      Check(diagnostic.text == "ERROR: Division by zero.", "runtime error text");
+      Check(out.GetBuffer() == "1\n", "output before runtime error");
+    }
+  }
+
+  // A cached program is reused only by the build that stored it, even with the same format version.
+  {
+    const std::filesystem::path dir = std::filesystem::temp_directory_path()
+      / ("macrocalc-api-test-" + std::to_string(std::random_device{}()));
+    const std::string script = "print(\"hi\");\n";
+    Bytecode stored;
+    stored.code = {{Bytecode::PRINT_STRING, 0, 0, 0}, {Bytecode::HALT, 0, 0, 0}};
+    stored.strings = {"hi\n"};
+    BytecodeCache(dir, 1).Store(script, BytecodeCache::FLAG_OPTIMIZED, stored);
+    Bytecode loaded;
+    Check(BytecodeCache(dir, 1).Load(script, BytecodeCache::FLAG_OPTIMIZED, loaded)
+          && loaded.strings == stored.strings, "cache hit from the same build");
+    Check(!BytecodeCache(dir, 2).Load(script, BytecodeCache::FLAG_OPTIMIZED, loaded),
+          "cache miss from another build");
+    std::error_code error;
+    std::filesystem::remove_all(dir, error);
+  }
+
+  if (failures) return 1;
+  std::cout << "API test: Passed!" << std::endl;
+  return 0;
+}
@@ -1,13 +1,21 @@
 #!/bin/bash
 
+# Extra flags for Project2, e.g. FLAGS="--engine=tree" ./run_tests.sh
+# "./run_tests.sh --perf" runs the performance gate instead; see the perf section below.
+# "./run_tests.sh --fused" reports how often each fused VM instruction runs over the tests.
+FLAGS=${FLAGS:-}
+export FLAGS
+# How many scripts to run at once; defaults to one per core.
+JOBS=${JOBS:-$(nproc 2> /dev/null || echo 1)}
+
 # Initialize a counter for differing files
 pass_count=0
 fail_count=0
-test_count=37
+test_count=44
 
 error_pass_count=0
 error_fail_count=0
-error_test_count=16
+error_test_count=22
 
 # Make sure we have directory current/ to put results in.
 if [ ! -d "$DIR" ]; then
@@ -15,18 +23,122 @@ if [ ! -d "$DIR" ]; then
     mkdir -p current
 fi
 
-# Loop through all the regular test file pairs
+# Files a run needs only while it checks results go in a private directory, removed on exit.
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+export SCRATCH
+
+# Perf mode: time every test-NN.Mc plus the stress scripts in perf/, PERF_RUNS times each,
+# and compare the median wall time and peak RSS with the checked-in baseline.  A script
+# fails when it is more than PERF_THRESHOLD percent worse and the difference is also above
+# PERF_MIN_MS (timings) or PERF_MIN_KB (memory), so tiny scripts do not fail on noise.
+# PERF_UPDATE=1 rewrites the baseline from this run instead of comparing.  The baseline is
+# only meaningful for the machine and FLAGS it was recorded with; use PERF_BASELINE to keep
+# several.
+if [ "$1" == "--perf" ]; then
+    export PERF_RUNS=${PERF_RUNS:-5}
+    PERF_THRESHOLD=${PERF_THRESHOLD:-25}
+    PERF_MIN_MS=${PERF_MIN_MS:-10}
+    PERF_MIN_KB=${PERF_MIN_KB:-2048}
+    PERF_BASELINE=${PERF_BASELINE:-perf/baseline.txt}
+    PERF_UPDATE=${PERF_UPDATE:-0}
+
+    # Run one script PERF_RUNS times; print "<script> <median microseconds> <peak RSS KB>".
+    # Peak RSS comes from the --stats report.
+    perf_script() {
+        local times=() rss=0 stats
+        stats=$(mktemp)
+        for ((r = 0; r < PERF_RUNS; r++)); do
+            local start=$(date +%s%N)
+            ../Project2 $FLAGS --stats "$1" > /dev/null 2> "$stats"
+            times+=($(( ($(date +%s%N) - start) / 1000 )))
+            local kb=$(awk '/peak RSS/ {print $3}' "$stats")
+            (( ${kb:-0} > rss )) && rss=$kb
+        done
+        rm -f "$stats"
+        local median=$(printf '%s\n' "${times[@]}" | sort -n | sed -n "$(( (PERF_RUNS + 1) / 2 ))p")
+        echo "$1 $median $rss"
+    }
+    export -f perf_script
+
+    ls test-[0-9]*.Mc perf/*.Mc | xargs -P "$JOBS" -n 1 bash -c 'perf_script "$0"' \
+        | sort > "$SCRATCH/perf-results.txt"
+
+    if [ "$PERF_UPDATE" == "1" ]; then
+        { echo "# script median_us peak_rss_kb  (FLAGS=\"$FLAGS\", PERF_RUNS=$PERF_RUNS)"
+          cat "$SCRATCH/perf-results.txt"; } > "$PERF_BASELINE"
+        echo "Wrote $(wc -l < "$SCRATCH/perf-results.txt") baselines to $PERF_BASELINE."
+        exit 0
+    fi
+    if [ ! -f "$PERF_BASELINE" ]; then
+        echo "No baseline $PERF_BASELINE; run with PERF_UPDATE=1 to create it."
+        exit 1
+    fi
+
+    awk -v threshold="$PERF_THRESHOLD" -v min_us=$((PERF_MIN_MS * 1000)) -v min_kb="$PERF_MIN_KB" '
+        FNR == NR { if ($1 !~ /^#/) { base_us[$1] = $2; base_kb[$1] = $3 } next }
+        {
+            if (!($1 in base_us)) { printf "Perf %s ... new (no baseline): %.1f ms, %d KB\n", $1, $2 / 1000, $3; next }
+            slow = $2 > base_us[$1] * (1 + threshold / 100) && $2 - base_us[$1] > min_us
+            big = $3 > base_kb[$1] * (1 + threshold / 100) && $3 - base_kb[$1] > min_kb
+            status = (slow || big) ? "Failed." : "Passed!"
+            printf "Perf %s ... %s  %.1f ms (baseline %.1f), %d KB (baseline %d)\n", $1, status,
+                   $2 / 1000, base_us[$1] / 1000, $3, base_kb[$1]
+            if (slow || big) failed++
+            checked++
+        }
+        END {
+            printf "Passed %d of %d perf checks (Failed %d, threshold %d%%)\n", checked - failed, checked, failed, threshold
+            exit failed > 0
+        }' "$PERF_BASELINE" "$SCRATCH/perf-results.txt"
+    exit $?
+fi
+
+# Fused mode: total the "fused" line of --stats over every test-NN.Mc, i.e. how many times
+# each kind of superinstruction ran on the VM.
+if [ "$1" == "--fused" ]; then
+    for script in test-[0-9]*.Mc; do
+        ../Project2 $FLAGS --stats "$script" 2>&1 > /dev/null | grep '^  fused'
+    done | awk '{
+            for (i = 2; i < NF; i += 2) {
+                count = $(i + 1); sub(",", "", count)
+                if (!($i in total)) order[++kinds] = $i
+                total[$i] += count
+            }
+        }
+        END { for (k = 1; k <= kinds; ++k) printf "%-16s %12d\n", order[k], total[order[k]] }'
+    exit 0
+fi
+
+# Run one script, saving its output and, in $SCRATCH/<out_file name>.status, its exit code.
+run_script() {
+    ../Project2 $FLAGS "$1" > "$2"
+    echo $? > "$SCRATCH/${2##*/}.status"
+}
+export -f run_script
+
+if [ ! -f "../Project2" ]; then
+    echo "Executable ../Project2 does not exist."
+    exit 1
+fi
+
+# Run every test script, JOBS at a time, then check the results in order.
+for i in $(seq -w 01 $test_count); do
+    [ -f "test-${i}.Mc" ] && echo "test-${i}.Mc current/output-${i}.txt"
+done | xargs -P "$JOBS" -n 2 bash -c 'run_script "$0" "$1"'
+for i in $(seq -w 01 $error_test_count); do
+    [ -f "test-error-${i}.Mc" ] && echo "test-error-${i}.Mc current/output-error-${i}.txt"
+done | xargs -P "$JOBS" -n 2 bash -c 'run_script "$0" "$1"'
+
+# Check all the regular test file pairs
 for i in $(seq -w 01 $test_count); do
     # Set the file names
     code_file="test-${i}.Mc"
     expected_file="expected/output-${i}.txt"
     out_file="current/output-${i}.txt"
 
-    # Generate the output file for Project2
-    if [[ -f "../Project2" && -f "$code_file" ]]; then
-        ../Project2 "$code_file" > "$out_file"
-    else
-        echo "Executable ../Project2 or code file $code_file does not exist."
+    if [[ ! -f "$code_file" ]]; then
+        echo "Code file $code_file does not exist."
         continue
     fi
 
@@ -45,22 +157,17 @@ for i in $(seq -w 01 $test_count); do
     fi
 done
 
-# Loop through all the ERROR test file pairs
+# Check the return code of every ERROR test
 for i in $(seq -w 01 $error_test_count); do
-    # Set the file names
     code_file="test-error-${i}.Mc"
     out_file="current/output-error-${i}.txt"
 
-    # Generate the output file for Project2
-    if [[ -f "../Project2" && -f "$code_file" ]]; then
-        ../Project2 "$code_file" > "$out_file"
-    else
-        echo "Executable ../Project2 or code file $code_file does not exist."
+    if [[ ! -f "$code_file" ]]; then
+        echo "Code file $code_file does not exist."
         continue
     fi
 
-    # Check the return code
-    if [ $? -ne 0 ]; then
+    if [ "$(cat "$SCRATCH/${out_file##*/}.status" 2> /dev/null)" != "0" ]; then
         echo "Error test $i ... Passed!"
         ((error_pass_count++))
     else
@@ -69,9 +176,87 @@ for i in $(seq -w 01 $error_test_count); do
     fi
 done
 
+# Run all the tests again in one process with --batch.  Each regular test's section must match
+# its expected output, and every error test must be reported with a non-zero exit.
+batch_fail_count=0
+regular_files=$(for i in $(seq -w 01 $test_count); do echo "test-${i}.Mc"; done)
+error_files=$(for i in $(seq -w 01 $error_test_count); do echo "test-error-${i}.Mc"; done)
+for i in $(seq -w 01 $test_count); do
+    echo "=== test-${i}.Mc: exit 0 ==="
+    cat "expected/output-${i}.txt"
+done > "$SCRATCH/expected-batch.txt"
+../Project2 $FLAGS --batch $regular_files $error_files > "$SCRATCH/output-batch.txt" 2> /dev/null
+if ! head -c "$(wc -c < "$SCRATCH/expected-batch.txt")" "$SCRATCH/output-batch.txt" | diff -q "$SCRATCH/expected-batch.txt" - > /dev/null; then
+    echo "Batch test ... Failed.  Regular test sections differ from the expected outputs."
+    batch_fail_count=1
+elif [ "$(grep -c '^=== test-error-.*: exit 1 ===$' "$SCRATCH/output-batch.txt")" -ne "$error_test_count" ]; then
+    echo "Batch test ... Failed.  Not every error test reported a non-zero exit."
+    batch_fail_count=1
+else
+    echo "Batch test ... Passed!"
+fi
+
+# Run each regular test twice against a fresh bytecode cache: the first run fills it and the
+# second must produce the same output from the cached program alone.
+cache_fail_count=0
+for i in $(seq -w 01 $test_count); do
+    ../Project2 $FLAGS --cache="$SCRATCH/cache" "test-${i}.Mc" > /dev/null
+    if ! ../Project2 $FLAGS --cache="$SCRATCH/cache" "test-${i}.Mc" | diff -q "expected/output-${i}.txt" - > /dev/null; then
+        echo "Cache test $i ... Failed.  Output from the cached program differs."
+        cache_fail_count=1
+    fi
+done
+[ $cache_fail_count -eq 0 ] && echo "Cache test ... Passed!"
+
+# Likewise with a fresh output memo: the second run replays the stored output and exit status.
+memo_fail_count=0
+for i in $(seq -w 01 $test_count); do
+    ../Project2 $FLAGS --memo="$SCRATCH/memo" "test-${i}.Mc" > /dev/null
+    if ! ../Project2 $FLAGS --memo="$SCRATCH/memo" "test-${i}.Mc" | diff -q "expected/output-${i}.txt" - > /dev/null; then
+        echo "Memo test $i ... Failed.  Replayed output differs."
+        memo_fail_count=1
+    fi
+done
+for i in $(seq -w 01 $error_test_count); do
+    ../Project2 $FLAGS --memo="$SCRATCH/memo" "test-error-${i}.Mc" > /dev/null 2>&1
+    if ../Project2 $FLAGS --memo="$SCRATCH/memo" "test-error-${i}.Mc" > /dev/null 2>&1; then
+        echo "Memo test error-$i ... Failed.  Replayed run returned zero."
+        memo_fail_count=1
+    fi
+done
+[ $memo_fail_count -eq 0 ] && echo "Memo test ... Passed!"
+
+# Parse and run scripts nested 1,000,000 levels deep: scopes, if statements, parentheses,
+# unary operators and an expression statement.  The parser, optimizer and bytecode compiler keep explicit stacks, so this
+# only needs memory.  The other engines still recurse and are skipped.
+deep_fail_count=0
+DEEP_LEVELS=1000000
+repeat() { head -c "$2" /dev/zero | tr '\0' "$1"; }
+deep_check() {
+    local output
+    output=$(../Project2 $FLAGS "$SCRATCH/deep-$1.Mc" 2>&1)
+    if [ "$output" != "$2" ]; then
+        echo "Deep nesting test $1 ... Failed.  Expected \"$2\", got \"${output:0:200}\"."
+        deep_fail_count=1
+    fi
+}
+if [[ " $FLAGS " != *" --engine="* || " $FLAGS " == *" --engine=vm "* ]]; then
+    { repeat '{' $DEEP_LEVELS; echo 'var y = 3; (y); ; print("{y}");'; repeat '}' $DEEP_LEVELS; echo; } > "$SCRATCH/deep-scopes.Mc"
+    { yes 'if (1)' | head -n $DEEP_LEVELS | tr -d '\n'; echo ' print("deep");'; } > "$SCRATCH/deep-ifs.Mc"
+    { echo -n 'var x = 7; x = '; repeat '(' $DEEP_LEVELS; echo -n 'x + 1'; repeat ')' $DEEP_LEVELS; echo '; print("{x}");'; } > "$SCRATCH/deep-parens.Mc"
+    { echo -n 'var x = 5; var y = '; repeat '-' $DEEP_LEVELS; echo -n 'x; var z = '; repeat '!' $((DEEP_LEVELS - 1)); echo 'x; print("{y} {z}");'; } > "$SCRATCH/deep-unary.Mc"
+    { echo -n 'var x = 2; '; repeat '(' $DEEP_LEVELS; echo -n '-x'; repeat ')' $DEEP_LEVELS; echo '; print("{x}");'; } > "$SCRATCH/deep-exprs.Mc"
+    deep_check scopes 3
+    deep_check ifs deep
+    deep_check parens 8
+    deep_check unary "5 0"
+    deep_check exprs 2
+    [ $deep_fail_count -eq 0 ] && echo "Deep nesting test ... Passed!"
+fi
+
 # Report the final count of differing files
 echo "Passed $pass_count of $test_count regular tests (Failed $fail_count)"
 echo "Passed $error_pass_count of $error_test_count error tests (Failed $error_fail_count)"
 
-total_fail_count=$((fail_count + error_fail_count))
+total_fail_count=$((fail_count + error_fail_count + batch_fail_count + cache_fail_count + memo_fail_count + deep_fail_count))
 exit $total_fail_count